@@ -0,0 +1,128 @@
+#include "ChunkedDataset.h"
+#include <algorithm>
+#include <cstring>
+#include <future>
+
+namespace rf {
+
+	// "RFD1", the number of attributes, the number of values, the rows per block, and the number of rows
+	static const int HEADER_SIZE = 4 + 3 * sizeof(int) + sizeof(long long);
+
+	ChunkedDataset::ChunkedDataset(const std::string& filename) {
+		this->filename = filename;
+
+		std::ifstream in(filename.c_str(), std::ios::binary);
+		if (!in) throw "File cannot open.";
+
+		char magic[4];
+		int header[3];
+		long long rows;
+		if (!in.read(magic, 4) || memcmp(magic, "RFD1", 4) != 0) throw "Invalid dataset file.";
+		if (!in.read((char*)header, sizeof(header)) || !in.read((char*)&rows, sizeof(rows))) throw "Invalid dataset file.";
+		if (header[0] <= 0 || header[1] < 0 || header[1] > 256 || header[2] <= 0 || rows < 0) throw "Invalid dataset file.";
+
+		num_attributes = header[0];
+		num_values = header[1];
+		block_rows = header[2];
+		num_rows = rows;
+	}
+
+	/**
+	 * Call visit for every block in order. The block's rows are stored column by column, and the block is only
+	 * valid during the call. The next block is read on another thread in the meantime.
+	 */
+	void ChunkedDataset::scan(const std::function<void(const DataBlock&)>& visit) const {
+		std::ifstream in(filename.c_str(), std::ios::binary);
+		if (!in) throw "File cannot open.";
+		in.seekg(HEADER_SIZE);
+
+		size_t num_blocks = (num_rows + block_rows - 1) / block_rows;
+		std::vector<unsigned char> buffers[2];
+		auto read = [&](size_t b) {
+			int rows = (int)std::min((size_t)block_rows, num_rows - b * block_rows);
+			buffers[b % 2].resize((size_t)rows * (num_attributes + 1));
+			if (!in.read((char*)buffers[b % 2].data(), buffers[b % 2].size())) throw "Invalid dataset file.";
+		};
+
+		// declared after the buffers, so that a read in flight is waited for before they are freed
+		std::future<void> pending;
+		if (num_blocks > 0) pending = std::async(std::launch::async, read, 0);
+		for (size_t b = 0; b < num_blocks; ++b) {
+			pending.get();
+			if (b + 1 < num_blocks) pending = std::async(std::launch::async, read, b + 1);
+
+			DataBlock block;
+			block.num_rows = (int)std::min((size_t)block_rows, num_rows - b * block_rows);
+			block.first_row = b * block_rows;
+			block.labels = buffers[b % 2].data();
+			block.data = block.labels + block.num_rows;
+			block.row_stride = 1;
+			block.column_stride = block.num_rows;
+			visit(block);
+		}
+	}
+
+	ChunkedDatasetWriter::ChunkedDatasetWriter(const std::string& filename, int num_attributes, int block_rows) : out(filename.c_str(), std::ios::binary) {
+		if (!out) throw "File cannot open.";
+
+		this->num_attributes = num_attributes;
+		this->block_rows = block_rows;
+		num_values = 0;
+		num_rows = 0;
+
+		// the header is written again with the final counts by close()
+		char header[HEADER_SIZE] = {};
+		out.write(header, HEADER_SIZE);
+	}
+
+	/**
+	 * Append count rows, stored row by row in data, with their labels.
+	 */
+	void ChunkedDatasetWriter::append(const unsigned char* data, const unsigned char* labels, int count) {
+		for (int i = 0; i < count; ++i) {
+			const unsigned char* row = data + (size_t)i * num_attributes;
+			this->data.insert(this->data.end(), row, row + num_attributes);
+			this->labels.push_back(labels[i]);
+			for (int a = 0; a < num_attributes; ++a) {
+				num_values = std::max(num_values, row[a] + 1);
+			}
+			num_rows++;
+
+			if (this->labels.size() == block_rows) writeBlock();
+		}
+	}
+
+	void ChunkedDatasetWriter::close() {
+		if (labels.size() > 0) writeBlock();
+
+		int header[3] = { num_attributes, num_values, block_rows };
+		long long rows = num_rows;
+		out.seekp(0);
+		out.write("RFD1", 4);
+		out.write((const char*)header, sizeof(header));
+		out.write((const char*)&rows, sizeof(rows));
+		if (!out) throw "File cannot be written.";
+		out.close();
+	}
+
+	/**
+	 * Write the rows of the current block, transposed into columns, and start a new block.
+	 */
+	void ChunkedDatasetWriter::writeBlock() {
+		int rows = labels.size();
+		std::vector<unsigned char> columns((size_t)rows * num_attributes);
+		for (int r = 0; r < rows; ++r) {
+			for (int a = 0; a < num_attributes; ++a) {
+				columns[(size_t)a * rows + r] = data[(size_t)r * num_attributes + a];
+			}
+		}
+
+		out.write((const char*)labels.data(), rows);
+		out.write((const char*)columns.data(), columns.size());
+		if (!out) throw "File cannot be written.";
+
+		data.clear();
+		labels.clear();
+	}
+
+}
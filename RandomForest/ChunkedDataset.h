@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string>
+#include <fstream>
+#include <vector>
+#include "RandomForest.h"
+
+namespace rf {
+	/**
+	 * Training rows in a file of blocks of block_rows rows, for datasets larger than memory. A block holds the
+	 * labels of its rows, then the values of every attribute for all of its rows, one column after the other.
+	 * scan() reads the next block while the current one is visited, so only two blocks are in memory at a time.
+	 */
+	class ChunkedDataset : public BlockSource {
+	private:
+		std::string filename;
+		int num_attributes;
+		int num_values;
+		int block_rows;
+		size_t num_rows;
+
+	public:
+		ChunkedDataset(const std::string& filename);
+
+		size_t numRows() const { return num_rows; }
+		int numAttributes() const { return num_attributes; }
+		int numValues() const { return num_values; }
+		void scan(const std::function<void(const DataBlock&)>& visit) const;
+	};
+
+	/**
+	 * Writes the rows appended to it into a ChunkedDataset file, keeping one block of rows in memory.
+	 * The file is complete once close() has been called.
+	 */
+	class ChunkedDatasetWriter {
+	private:
+		std::ofstream out;
+		int num_attributes;
+		int num_values;
+		int block_rows;
+		size_t num_rows;
+		std::vector<unsigned char> data;	// the rows of the current block, row by row
+		std::vector<unsigned char> labels;
+
+	public:
+		ChunkedDatasetWriter(const std::string& filename, int num_attributes, int block_rows = 65536);
+
+		void append(const unsigned char* data, const unsigned char* labels, int count);
+		size_t size() const { return num_rows; }
+		void close();
+
+	private:
+		void writeBlock();
+	};
+
+}
@@ -0,0 +1,167 @@
+#include "CodeGenerator.h"
+#include <fstream>
+#include <iomanip>
+
+namespace rf {
+
+	void CodeGenerator::generate(const RandomForest& forest, const std::string& filename, const std::string& function_name) {
+		std::ofstream out(filename.c_str());
+		if (!out) throw "File cannot open.";
+
+		generate(forest, out, function_name);
+	}
+
+	void CodeGenerator::generate(const RandomForest& forest, std::ostream& out, const std::string& function_name) {
+		if (forest.numTrees() == 0) throw "Random forest is not constructed.";
+
+		// the votes of every label are scaled by its prior
+		std::vector<float> weights(Example::NUM_LABELS, 1.0f);
+		if (forest.getPriors().size() > 0) weights = forest.getPriors();
+
+		// print floats with enough digits to round-trip exactly
+		out << std::setprecision(9);
+
+		out << "// Generated by rf::CodeGenerator from a forest of " << forest.numTrees() << " trees. Do not edit." << std::endl;
+		out << std::endl;
+
+		for (int i = 0; i < forest.numTrees(); ++i) {
+			std::vector<int> parents;
+			countParents(forest.tree(i), parents);
+			std::vector<bool> generated(parents.size(), false);
+
+			out << "static inline void " << function_name << "_tree" << i << "(const unsigned char* data, const int* attribute_offsets, float* votes) {" << std::endl;
+			generateNode(out, forest.tree(i), 0, weights, parents, generated, "\t");
+			out << "}" << std::endl;
+			out << std::endl;
+		}
+
+		out << "int " << function_name << "(const unsigned char* data, const int* attribute_offsets, float* probabilities) {" << std::endl;
+		out << "\tfloat votes[" << Example::NUM_LABELS << "] = {};" << std::endl;
+		for (int i = 0; i < forest.numTrees(); ++i) {
+			out << "\t" << function_name << "_tree" << i << "(data, attribute_offsets, votes);" << std::endl;
+		}
+		out << std::endl;
+
+		// find the maximum vote with the same tie-breaking as RandomForest::test
+		out << "\tfloat max_votes = 0.0f;" << std::endl;
+		out << "\tfloat total_votes = 0.0f;" << std::endl;
+		out << "\tint max_voted_label = " << (int)Example::LABEL_UNKNOWN << ";" << std::endl;
+		for (int label = 0; label < Example::NUM_LABELS; ++label) {
+			out << "\ttotal_votes += votes[" << label << "];" << std::endl;
+			out << "\tif (votes[" << label << "] > max_votes) { max_votes = votes[" << label << "]; max_voted_label = " << label << "; }" << std::endl;
+		}
+		out << std::endl;
+		out << "\tif (probabilities != 0) {" << std::endl;
+		for (int label = 0; label < Example::NUM_LABELS; ++label) {
+			out << "\t\tprobabilities[" << label << "] = total_votes > 0 ? votes[" << label << "] / total_votes : 0.0f;" << std::endl;
+		}
+		out << "\t}" << std::endl;
+		out << std::endl;
+		out << "\treturn max_voted_label;" << std::endl;
+		out << "}" << std::endl;
+	}
+
+	/**
+	 * Count the child slots that refer to every node reachable from the root. After DecisionTree::compact(),
+	 * a node may have several parents, or the same parent through several slots.
+	 */
+	void CodeGenerator::countParents(const DecisionTree& tree, std::vector<int>& parents) {
+		parents.assign(tree.numNodes(), 0);
+		if (tree.numNodes() == 0) return;
+
+		std::vector<int> stack(1, 0);
+		while (stack.size() > 0) {
+			int node_id = stack.back();
+			stack.pop_back();
+			if (tree.node(node_id).isLeaf()) continue;
+
+			for (int slot = 0; slot < tree.numSlots(); ++slot) {
+				int child = tree.childAt(node_id, slot);
+				if (child < 0) continue;
+
+				// visit the children of a node only when it is first reached
+				if (parents[child]++ == 0) stack.push_back(child);
+			}
+		}
+	}
+
+	/**
+	 * Generate the code of the subtree of node_id. A node with several parents is generated once,
+	 * under a label that the code of its other parents jumps to, so the code grows with the stored nodes
+	 * rather than with the nodes of the expanded tree. Every path through the code ends with a return.
+	 */
+	void CodeGenerator::generateNode(std::ostream& out, const DecisionTree& tree, int node_id, const std::vector<float>& weights, const std::vector<int>& parents, std::vector<bool>& generated, const std::string& indent) {
+		const DecisionTreeNode& node = tree.node(node_id);
+
+		if (parents[node_id] > 1) {
+			if (generated[node_id]) {
+				out << indent << "goto node" << node_id << ";" << std::endl;
+				return;
+			}
+			generated[node_id] = true;
+			out << indent << "node" << node_id << ":" << std::endl;
+		}
+
+		if (node.isLeaf()) {
+			generateVotes(out, tree, node_id, weights, indent);
+			out << indent << "return;" << std::endl;
+			return;
+		}
+
+		if (tree.thresholdSplits()) {
+			for (int slot = 0; slot < 2; ++slot) {
+				if (slot == 0) {
+					out << indent << "if (data[attribute_offsets[" << node.split_attribute_id << "]] <= " << (int)node.threshold << ") {" << std::endl;
+				}
+				else {
+					out << indent << "else {" << std::endl;
+				}
+
+				int child = tree.childAt(node_id, slot);
+				if (child >= 0) {
+					generateNode(out, tree, child, weights, parents, generated, indent + "\t");
+				}
+				else {
+					generateVotes(out, tree, node_id, weights, indent + "\t");
+					out << indent << "\treturn;" << std::endl;
+				}
+				out << indent << "}" << std::endl;
+			}
+			return;
+		}
+
+		out << indent << "switch (data[attribute_offsets[" << node.split_attribute_id << "]]) {" << std::endl;
+		for (int value = 0; value < tree.numValues(); ++value) {
+			int child = tree.child(node_id, value);
+			if (child < 0) continue;
+
+			out << indent << "case " << value << ":" << std::endl;
+			generateNode(out, tree, child, weights, parents, generated, indent + "\t");
+		}
+
+		// values without a child fall back to the votes of this node
+		out << indent << "default:" << std::endl;
+		generateVotes(out, tree, node_id, weights, indent + "\t");
+		out << indent << "\treturn;" << std::endl;
+		out << indent << "}" << std::endl;
+	}
+
+	void CodeGenerator::generateVotes(std::ostream& out, const DecisionTree& tree, int node_id, const std::vector<float>& weights, const std::string& indent) {
+		if (tree.hasHistograms()) {
+			const unsigned char* histogram = tree.histogram(node_id);
+			for (int label = 0; label < Example::NUM_LABELS; ++label) {
+				float vote = histogram[label] * weights[label];
+				if (vote == 0.0f) continue;
+
+				out << indent << "votes[" << label << "] += " << std::showpoint << vote << std::noshowpoint << "f;" << std::endl;
+			}
+		}
+		else {
+			unsigned char label = tree.nodeLabel(node_id);
+			if (weights[label] != 0.0f) {
+				out << indent << "votes[" << (int)label << "] += " << std::showpoint << weights[label] << std::noshowpoint << "f;" << std::endl;
+			}
+		}
+	}
+
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+#include "RandomForest.h"
+
+namespace rf {
+	/**
+	 * Compiles a trained forest into a self-contained C++ translation unit.
+	 * Every tree becomes nested switch statements on the attribute values (if-else for threshold splits), with the
+	 * prior-weighted votes of each leaf folded into constants, and the generated function
+	 *
+	 *     int function_name(const unsigned char* data, const int* attribute_offsets, float* probabilities);
+	 *
+	 * returns the same labels and probabilities as RandomForest::test without reading any model data. Attribute a
+	 * is read from data[attribute_offsets[a]], as in DecisionTree::findNode, so patches can be labelled in place
+	 * and only the attributes the trees split on are read; a dense row takes the offsets 0, 1, 2 and so on.
+	 * Subtrees shared after DecisionTree::compact() are generated once. The code takes about a line per child slot
+	 * and leaf vote, so a forest of millions of nodes makes a file that compilers build slowly, if at all;
+	 * such forests are better kept as binary models.
+	 */
+	class CodeGenerator {
+	public:
+		static void generate(const RandomForest& forest, const std::string& filename, const std::string& function_name = "rf_generated_predict");
+		static void generate(const RandomForest& forest, std::ostream& out, const std::string& function_name = "rf_generated_predict");
+
+	private:
+		static void countParents(const DecisionTree& tree, std::vector<int>& parents);
+		static void generateNode(std::ostream& out, const DecisionTree& tree, int node_id, const std::vector<float>& weights, const std::vector<int>& parents, std::vector<bool>& generated, const std::string& indent);
+		static void generateVotes(std::ostream& out, const DecisionTree& tree, int node_id, const std::vector<float>& weights, const std::string& indent);
+	};
+
+}
@@ -0,0 +1,440 @@
+#include "ECPPipeline.h"
+#include <QDir>
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <memory>
+#include "MemoryStats.h"
+#include "CodeGenerator.h"
+#include <time.h>
+
+#ifdef RF_GENERATED_FOREST
+// predictor compiled from a forest exported with --export-cpp
+int rf_generated_predict(const unsigned char* data, const int* attribute_offsets, float* probabilities);
+#endif
+
+cv::Vec3b convertLabelToColor(unsigned char label) {
+	if (label == rf::Example::LABEL_WALL) {
+		return cv::Vec3b(0, 255, 255);
+	}
+	else if (label == rf::Example::LABEL_WINDOW) {
+		return cv::Vec3b(0, 0, 255);
+	}
+	else if (label == rf::Example::LABEL_DOOR) {
+		return cv::Vec3b(0, 128, 255);
+	}
+	else if (label == rf::Example::LABEL_BALCONY) {
+		return cv::Vec3b(255, 0, 128);
+	}
+	else if (label == rf::Example::LABEL_SHOP) {
+		return cv::Vec3b(0, 255, 0);
+	}
+	else if (label == rf::Example::LABEL_ROOF) {
+		return cv::Vec3b(255, 0, 0);
+	}
+	else if (label == rf::Example::LABEL_SKY) {
+		return cv::Vec3b(255, 255, 128);
+	}
+	else {
+		//return cv::Vec3b(0, 0, 0);
+		// HACK
+		// if the label is unknown, assume it is wall.
+		return cv::Vec3b(0, 255, 255);
+	}
+}
+
+unsigned char convertColorToLabel(const cv::Vec3b& color) {
+	if (color == cv::Vec3b(0, 255, 255)) {
+		return rf::Example::LABEL_WALL;
+	}
+	else if (color == cv::Vec3b(0, 0, 255)) {
+		return rf::Example::LABEL_WINDOW;
+	}
+	else if (color == cv::Vec3b(0, 128, 255)) {
+		return rf::Example::LABEL_DOOR;
+	}
+	else if (color == cv::Vec3b(255, 0, 128)) {
+		return rf::Example::LABEL_BALCONY;
+	}
+	else if (color == cv::Vec3b(0, 255, 0)) {
+		return rf::Example::LABEL_SHOP;
+	}
+	else if (color == cv::Vec3b(255, 0, 0)) {
+		return rf::Example::LABEL_ROOF;
+	}
+	else if (color == cv::Vec3b(255, 255, 128)) {
+		return rf::Example::LABEL_SKY;
+	}
+	else {
+		return rf::Example::LABEL_UNKNOWN;
+	}
+}
+
+rf::Example extractExampleFromPatch(const cv::Mat& patch, const cv::Vec3b& ground_truth) {
+	rf::Example example;
+	example.data.reserve(patch.rows * patch.cols);
+
+	for (int index = 0; index < patch.rows * patch.cols; ++index) {
+		int y = index / patch.cols;
+		int x = index % patch.cols;
+
+		example.data.push_back(quantizeColor(patch.at<cv::Vec3b>(y, x)));
+	}
+
+	example.label = convertColorToLabel(ground_truth);
+
+	return example;
+}
+
+/**
+ * Fill in the fraction and the estimated remaining time, and pass the progress to the monitor.
+ */
+void reportProgress(rf::ProgressMonitor* monitor, rf::Progress& progress, float fraction, const std::chrono::steady_clock::time_point& start) {
+	progress.fraction = fraction;
+	float elapsed = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+	if (fraction > 0) {
+		progress.seconds_remaining = elapsed * (1.0f - fraction) / fraction;
+	}
+	monitor->onProgress(progress);
+}
+
+/**
+ * Add how often the patches of every image in image_dir visit every node of the forest, reading the patches
+ * in place as testByECP does. The images should resemble the ones the forest will label; the training images
+ * would favour the paths that the trees were fit to. Return false if no image could be read.
+ */
+bool profileByECP(const rf::RandomForest& forest, const std::string& image_dir, std::vector<std::vector<long long> >& visits) {
+	const int patch_size = 15;
+
+	QDir profile_images_dir(QString::fromStdString(image_dir));
+	QStringList profile_image_files = profile_images_dir.entryList(QDir::NoDotAndDotDot | QDir::Files);
+	PatchExtractor extractor(patch_size);
+	bool profiled = false;
+	for (int i = 0; i < profile_image_files.size(); ++i) {
+		cv::Mat image = cv::imread((profile_images_dir.absolutePath() + "/" + profile_image_files[i]).toUtf8().constData());
+		if (image.empty()) continue;
+
+		extractor.setImage(image);
+		for (int row = 0; row < extractor.numRows(); row++) {
+			forest.countVisits(extractor.rowData(row), extractor.stride, extractor.numColumns(), visits, extractor.attribute_offsets.data());
+		}
+		profiled = true;
+	}
+	return profiled;
+}
+
+ECPOptions::ECPOptions() {
+	stride = 1;
+	deduplicate = false;
+	num_threads = 0;
+	poisson_bagging = false;
+	threshold_splits = false;
+	criterion = rf::TrainingParams::CRITERION_ENTROPY;
+	num_random_splits = 0;
+	min_samples_split = 2;
+	min_samples_leaf = 1;
+	min_gain = 0.0f;
+	max_leaf_nodes = 0;
+	best_first = false;
+	level_wise = false;
+	max_tree_nodes = 0;
+	max_tree_bytes = 0;
+	benchmark_criteria = false;
+	estimate_oob = false;
+	test = true;
+}
+
+/**
+ * Build the training dataset from the ECP images, construct a random forest, and label the test images.
+ * The monitor receives the progress of each stage, and can cancel the job between images or tree nodes.
+ * Return false if the job was cancelled.
+ */
+bool trainByECP(rf::ProgressMonitor* monitor, const ECPOptions& options) {
+	const int patch_size = 15;
+	const int T = 10;
+	const float r = 0.5;
+	const int max_depth = 18;
+
+	time_t start = clock();
+	std::chrono::steady_clock::time_point progress_start = std::chrono::steady_clock::now();
+	rf::MemoryPhase dataset_phase("dataset");
+	QDir ground_truth_dir("../ECP/ground_truth/");
+	QDir train_images_dir("../ECP/images_train/");
+
+	rf::Progress progress("dataset");
+	QStringList train_image_files = train_images_dir.entryList(QDir::NoDotAndDotDot | QDir::Files);// , QDir::DirsFirst);
+	rf::Dataset examples(patch_size * patch_size);
+	PatchExtractor extractor(patch_size, options.stride);
+	bool sampling = options.class_targets.size() > 0 || options.class_ratios.size() > 0;
+	rf::StratifiedSampler sampler(patch_size * patch_size, options.class_targets, options.class_ratios);
+	std::unique_ptr<rf::ChunkedDatasetWriter> writer(options.out_of_core.empty() ? NULL : new rf::ChunkedDatasetWriter(options.out_of_core, patch_size * patch_size));
+	for (int i = 0; i < train_image_files.size(); ++i) {
+		if (monitor->isCancelled()) return false;
+
+		// remove the file extension
+		int index = train_image_files[i].lastIndexOf(".");
+		QString filename = train_image_files[i].left(index);
+
+		//std::cout << image_file.toUtf8().constData() << std::endl;
+		cv::Mat image = cv::imread((train_images_dir.absolutePath() + "/" + filename + ".jpg").toUtf8().constData());
+		cv::Mat ground_truth = cv::imread((ground_truth_dir.absolutePath() + "/" + filename + ".png").toUtf8().constData());
+		//std::cout << "(" << image.rows << " x " << image.cols << ")" << std::endl;
+
+		size_t image_begin = examples.size();
+		extractor.setImage(image);
+		if (sampling) {
+			std::vector<unsigned char> row_data(extractor.numColumns() * patch_size * patch_size);
+			std::vector<unsigned char> row_labels(extractor.numColumns());
+			for (int row = 0; row < extractor.numRows(); ++row) {
+				extractor.extractRow(row, ground_truth, row_data.data(), row_labels.data());
+				sampler.add(row_data.data(), row_labels.data(), extractor.numColumns());
+			}
+			sampler.endImage(examples);
+		}
+		else {
+			for (int row = 0; row < extractor.numRows(); ++row) {
+				extractor.extractRow(row, ground_truth, examples);
+			}
+		}
+
+		// most duplicates come from flat regions of the same image
+		if (options.deduplicate && !writer) examples.deduplicate(image_begin);
+
+		// only the patches of the current image stay in memory
+		if (writer) {
+			writer->append(examples.data.data(), examples.labels.data(), examples.size());
+			examples.clear();
+		}
+
+		progress.num_examples_processed = writer ? writer->size() : examples.size();
+		reportProgress(monitor, progress, (float)(i + 1) / train_image_files.size(), progress_start);
+	}
+	if (options.deduplicate && !writer) examples.deduplicate();
+	std::unique_ptr<rf::ChunkedDataset> chunks;
+	if (writer) {
+		writer->close();
+		chunks.reset(new rf::ChunkedDataset(options.out_of_core));
+	}
+	dataset_phase.end();
+
+	time_t end = clock();
+
+	std::cout << "Dataset has been created." << std::endl;
+	std::cout << "#examples: " << (chunks ? chunks->numRows() : examples.size()) << std::endl;
+	if (chunks) std::cout << "Examples have been written to " << options.out_of_core << "." << std::endl;
+	if (options.deduplicate && !chunks) std::cout << "#examples before deduplication: " << examples.totalWeight() << std::endl;
+	std::cout << "#attributes: " << examples.num_attributes << std::endl;
+	if (sampling) sampler.print();
+	std::cout << "Elapsed: " << (end - start) / CLOCKS_PER_SEC << " sec." << std::endl;
+
+	// create random forest
+	start = clock();
+	rf::TrainingParams params;
+	params.num_trees = T;
+	params.ratio = r;
+	params.max_depth = max_depth;
+	params.leaf_histograms = true;
+	params.poisson_bagging = options.poisson_bagging;
+	if (options.threshold_splits) params.split_type = rf::TrainingParams::SPLIT_THRESHOLD;
+	params.criterion = options.criterion;
+	params.extra_trees = options.num_random_splits > 0;
+	if (params.extra_trees) params.num_random_splits = options.num_random_splits;
+	params.min_samples_split = options.min_samples_split;
+	params.min_samples_leaf = options.min_samples_leaf;
+	params.min_gain = options.min_gain;
+	params.max_leaf_nodes = options.max_leaf_nodes;
+	if (options.best_first) params.growth = rf::TrainingParams::GROWTH_BEST_FIRST;
+	else if (options.level_wise) params.growth = rf::TrainingParams::GROWTH_LEVEL_WISE;
+	params.max_nodes = options.max_tree_nodes;
+	params.max_bytes = options.max_tree_bytes;
+	params.estimate_oob = options.estimate_oob;
+	params.num_threads = options.num_threads > 0 ? options.num_threads : std::max(1u, std::thread::hardware_concurrency());
+	params.priors.resize(rf::Example::NUM_LABELS);
+	params.priors[rf::Example::LABEL_WALL] = 1;
+	params.priors[rf::Example::LABEL_WINDOW] = 1.8;
+	params.priors[rf::Example::LABEL_DOOR] = 4;
+	params.priors[rf::Example::LABEL_BALCONY] = 2;
+	params.priors[rf::Example::LABEL_SHOP] = 1.5;
+	params.priors[rf::Example::LABEL_ROOF] = 3.4;
+	params.priors[rf::Example::LABEL_SKY] = 1.5;
+	params.priors[rf::Example::LABEL_UNKNOWN] = 0;
+	if (sampling) {
+		// the priors above are for the full set of patches
+		params.priors = sampler.priors(params.priors);
+	}
+
+	if (options.benchmark_criteria) {
+		// train on the same patches with every criterion, and compare without a test pass
+		std::cout << "Criterion\tTraining (sec.)\tOOB error\t#nodes" << std::endl;
+		for (int criterion = 0; criterion < rf::TrainingParams::NUM_CRITERIA; ++criterion) {
+			rf::TrainingParams benchmark_params = params;
+			benchmark_params.criterion = criterion;
+			benchmark_params.estimate_oob = true;
+
+			std::chrono::steady_clock::time_point benchmark_start = std::chrono::steady_clock::now();
+			rf::RandomForest benchmark_forest;
+			bool finished = chunks ? benchmark_forest.construct(*chunks, benchmark_params, monitor) : benchmark_forest.construct(examples, benchmark_params, monitor);
+			if (!finished) return false;
+			float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - benchmark_start).count();
+
+			std::cout << rf::TrainingParams::criterionName(criterion) << "\t" << seconds << "\t" << benchmark_forest.oob().error() << "\t" << benchmark_forest.stats().total.num_nodes << std::endl;
+		}
+		return true;
+	}
+	rf::RandomForest rand_forest;
+	rf::MemoryPhase forest_phase("forest");
+	bool finished = chunks ? rand_forest.construct(*chunks, params, monitor) : rand_forest.construct(examples, params, monitor);
+	if (!finished) return false;
+	forest_phase.end();
+	//rand_forest.save("forest.xml");
+	end = clock();
+	std::cout << "Random forest has been created." << std::endl;
+	std::cout << "Elapsed: " << (end - start) / CLOCKS_PER_SEC << " sec." << std::endl;
+	rand_forest.stats().print();
+	std::cout << "Forest uses " << rand_forest.usedAttributes().size() << " of " << examples.num_attributes << " attributes." << std::endl;
+	if (options.estimate_oob) rand_forest.oob().print();
+	rand_forest.importance().print(patch_size);
+
+	// share the identical subtrees
+	size_t bytes = rand_forest.stats().total.bytes;
+	rand_forest.compact();
+	std::cout << "Compacted the forest from " << bytes / 1024 << " KB to " << rand_forest.stats().total.bytes / 1024 << " KB." << std::endl;
+
+	// lay out the nodes by how often the patches of the profile images visit them
+	if (!options.profile_images.empty()) {
+		std::vector<std::vector<long long> > visits;
+		if (!profileByECP(rand_forest, options.profile_images, visits)) throw "No profile image could be read.";
+		rand_forest.reorder(visits);
+	}
+
+	if (!options.save_model.empty()) {
+		rand_forest.saveBinary(options.save_model);
+		std::cout << "Forest has been saved to " << options.save_model << "." << std::endl;
+	}
+
+	if (!options.export_cpp.empty()) {
+		rf::CodeGenerator::generate(rand_forest, options.export_cpp);
+		std::cout << "Forest has been exported to " << options.export_cpp << "." << std::endl;
+	}
+
+
+	// release the memory for the training data
+	examples.clear();
+	if (!options.test) return true;
+
+	// test
+	return testByECP([&rand_forest](const unsigned char* data, int stride, int count, const int* attribute_offsets, unsigned char* labels) {
+		rand_forest.test(data, stride, count, labels, NULL, attribute_offsets);
+	}, monitor);
+}
+
+#ifdef RF_GENERATED_FOREST
+/**
+ * Label the test images with the forest compiled into the executable, without any training.
+ */
+bool testGeneratedByECP(rf::ProgressMonitor* monitor) {
+	return testByECP([](const unsigned char* data, int stride, int count, const int* attribute_offsets, unsigned char* labels) {
+		// the generated code reads the attributes it splits on in place, as the interpreted forest does
+		for (int i = 0; i < count; ++i) {
+			labels[i] = rf_generated_predict(data + (size_t)i * stride, attribute_offsets, NULL);
+		}
+	}, monitor);
+}
+#endif
+
+/**
+ * Label the test images with a forest loaded from a binary model file, without any training.
+ */
+bool testModelByECP(const std::string& model_file, rf::ProgressMonitor* monitor) {
+	rf::RandomForest rand_forest;
+	rand_forest.loadBinary(model_file);
+	if (rand_forest.numAttributes() != 0 && rand_forest.numAttributes() != 15 * 15) throw "The model was not trained on 15x15 patches.";
+	std::cout << "Forest has been loaded from " << model_file << "." << std::endl;
+	rand_forest.stats().print();
+
+	return testByECP([&rand_forest](const unsigned char* data, int stride, int count, const int* attribute_offsets, unsigned char* labels) {
+		rand_forest.test(data, stride, count, labels, NULL, attribute_offsets);
+	}, monitor);
+}
+
+/**
+ * Label every pixel of the ECP test images with the given predictor, write the label images to results/,
+ * and print the throughput and the confusion matrix. Every image is quantized once, and the patches of an
+ * image row are labelled as one batch that reads the attributes in place from the quantized image.
+ * Return false if the job was cancelled.
+ */
+bool testByECP(const BatchPredictor& predict, rf::ProgressMonitor* monitor) {
+	const int patch_size = 15;
+
+	QDir ground_truth_dir("../ECP/ground_truth/");
+	QDir test_images_dir("../ECP/images_test/");
+
+	time_t start = clock();
+	rf::MemoryPhase test_phase("test");
+	QDir result_dir("results/");
+	cv::Mat confusionMatrix(7, 7, CV_32F, cv::Scalar(0.0f));
+	rf::Progress progress("test");
+	std::chrono::steady_clock::time_point progress_start = std::chrono::steady_clock::now();
+	QStringList test_image_files = test_images_dir.entryList(QDir::NoDotAndDotDot | QDir::Files);// , QDir::DirsFirst);
+	PatchExtractor extractor(patch_size);
+	for (int i = 0; i < test_image_files.size(); ++i) {
+		if (monitor->isCancelled()) return false;
+
+		// remove the file extension
+		int index = test_image_files[i].lastIndexOf(".");
+		QString filename = test_image_files[i].left(index);
+
+		cv::Mat image = cv::imread((test_images_dir.absolutePath() + "/" + filename + ".jpg").toUtf8().constData());
+		cv::Mat ground_truth = cv::imread((ground_truth_dir.absolutePath() + "/" + filename + ".png").toUtf8().constData());
+
+		cv::Mat result(image.size(), image.type(), cv::Vec3b(0, 0, 0));
+		extractor.setImage(image);
+		std::vector<unsigned char> row_labels(extractor.numColumns());
+		for (int row = 0; row < extractor.numRows(); row++) {
+			predict(extractor.rowData(row), extractor.stride, extractor.numColumns(), extractor.attribute_offsets.data(), row_labels.data());
+
+			for (int column = 0; column < extractor.numColumns(); column++) {
+				unsigned char label = row_labels[column];
+
+				// HACK
+				// if the label cannot be estimated, assume it is wall
+				if (label == rf::Example::LABEL_UNKNOWN) {
+					label = rf::Example::LABEL_WALL;
+				}
+				result.at<cv::Vec3b>(extractor.center(row, column)) = convertLabelToColor(label);
+
+
+				cv::Vec3b ground_truth_color = ground_truth.at<cv::Vec3b>(extractor.center(row, column));
+				unsigned char ground_truth_label = convertColorToLabel(ground_truth_color);
+
+				// update confusion matrix
+				confusionMatrix.at<float>(ground_truth_label, label) += 1;
+				progress.num_examples_processed++;
+			}
+		}
+
+		cv::imwrite((result_dir.absolutePath() + "/" + filename + ".png").toUtf8().constData(), result);
+		reportProgress(monitor, progress, (float)(i + 1) / test_image_files.size(), progress_start);
+	}
+	test_phase.end();
+	time_t end = clock();
+	float elapsed = std::chrono::duration<float>(std::chrono::steady_clock::now() - progress_start).count();
+	std::cout << "Test has been finished." << std::endl;
+	std::cout << "Elapsed: " << (end - start) / CLOCKS_PER_SEC << " sec." << std::endl;
+	std::cout << "Throughput: " << (long long)(progress.num_examples_processed / std::max(elapsed, 1e-3f)) << " examples/sec." << std::endl;
+
+	std::cout << "Confusion matrix:" << std::endl;
+	cv::Mat confusionMatrixSum;
+	cv::reduce(confusionMatrix, confusionMatrixSum, 1, cv::REDUCE_SUM);
+	for (int r = 0; r < confusionMatrix.rows; ++r) {
+		for (int c = 0; c < confusionMatrix.cols; ++c) {
+			if (c > 0) std::cout << ", ";
+			std::cout << confusionMatrix.at<float>(r, c) / confusionMatrixSum.at<float>(r, 0);
+		}
+		std::cout << std::endl;
+	}
+	std::cout << std::endl;
+
+	return true;
+}
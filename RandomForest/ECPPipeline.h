@@ -0,0 +1,80 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <opencv2/opencv.hpp>
+#include "RandomForest.h"
+#include "PatchExtractor.h"
+#include "StratifiedSampler.h"
+#include "ChunkedDataset.h"
+
+/**
+ * Options of the ECP pipeline. Training patches are taken every stride pixels, and if class_targets or
+ * class_ratios is not empty, subsampled per image and label by rf::StratifiedSampler, in which case the
+ * vote priors are scaled by the sampling weights. With deduplicate, identical patches with the same label
+ * are stored once with a weight, see rf::Dataset::deduplicate.
+ *
+ * The trees are built num_threads at a time (0 for one per hardware thread), from Poisson bootstrap samples
+ * with poisson_bagging. With threshold_splits, every node splits in two on value <= threshold instead of once
+ * per value. The splits minimize the given rf::TrainingParams criterion, among num_random_splits random splits
+ * per node if that is above zero (extra trees). With benchmark_criteria, a forest is trained with every
+ * criterion instead, and their training times and out-of-bag errors are compared. min_samples_split,
+ * min_samples_leaf, min_gain and max_leaf_nodes stop the growth of the trees as in rf::TrainingParams. With
+ * best_first, the trees grow best-first, and with level_wise, one depth at a time from a sequential pass over
+ * the training patches. max_tree_nodes and max_tree_bytes limit the size of every tree. If out_of_core names a
+ * file, the patches of every image are written to it as an rf::ChunkedDataset instead of being kept in memory,
+ * and the trees are built level-wise from the file, two at a time at most. The patches are then not deduplicated.
+ *
+ * With estimate_oob, the out-of-bag error of the forest is printed after training, see rf::OOBEstimate, and
+ * with test unset, the test images are skipped. export_cpp names the C++ source the trained forest is
+ * compiled into, and save_model the binary model file the compacted forest is saved to, if not empty. If
+ * profile_images names a directory, the nodes of the forest are laid out by how often the patches of its images
+ * visit them before the forest is saved or tested, see profileByECP.
+ */
+class ECPOptions {
+public:
+	int stride;
+	std::vector<int> class_targets;
+	std::vector<float> class_ratios;
+	bool deduplicate;
+	int num_threads;
+	bool poisson_bagging;
+	bool threshold_splits;
+	int criterion;
+	int num_random_splits;
+	int min_samples_split;
+	int min_samples_leaf;
+	float min_gain;
+	int max_leaf_nodes;
+	bool best_first;
+	bool level_wise;
+	int max_tree_nodes;
+	size_t max_tree_bytes;
+	std::string out_of_core;
+	bool benchmark_criteria;
+	bool estimate_oob;
+	bool test;
+	std::string export_cpp;
+	std::string save_model;
+	std::string profile_images;
+
+public:
+	ECPOptions();
+};
+
+cv::Vec3b convertLabelToColor(unsigned char label);
+unsigned char convertColorToLabel(const cv::Vec3b& color);
+rf::Example extractExampleFromPatch(const cv::Mat& patch, const cv::Vec3b& ground_truth);
+bool trainByECP(rf::ProgressMonitor* monitor, const ECPOptions& options = ECPOptions());
+bool profileByECP(const rf::RandomForest& forest, const std::string& image_dir, std::vector<std::vector<long long> >& visits);
+/**
+ * Labels count examples whose rows start stride bytes apart. The value of attribute a of an example
+ * is at row[attribute_offsets[a]], as in rf::DecisionTree::findNode.
+ */
+typedef std::function<void(const unsigned char* data, int stride, int count, const int* attribute_offsets, unsigned char* labels)> BatchPredictor;
+
+bool testByECP(const BatchPredictor& predict, rf::ProgressMonitor* monitor);
+bool testModelByECP(const std::string& model_file, rf::ProgressMonitor* monitor);
+#ifdef RF_GENERATED_FOREST
+bool testGeneratedByECP(rf::ProgressMonitor* monitor);
+#endif
@@ -29,6 +29,7 @@ public:
     QAction *actionExit;
     QAction *actionTrainByECP;
     QAction *actionDecisionTreeTest;
+    QAction *actionCancel;
     QWidget *centralWidget;
     QMenuBar *menuBar;
     QMenu *menuFile;
@@ -47,6 +48,8 @@ public:
         actionTrainByECP->setObjectName(QStringLiteral("actionTrainByECP"));
         actionDecisionTreeTest = new QAction(MainWindowClass);
         actionDecisionTreeTest->setObjectName(QStringLiteral("actionDecisionTreeTest"));
+        actionCancel = new QAction(MainWindowClass);
+        actionCancel->setObjectName(QStringLiteral("actionCancel"));
         centralWidget = new QWidget(MainWindowClass);
         centralWidget->setObjectName(QStringLiteral("centralWidget"));
         MainWindowClass->setCentralWidget(centralWidget);
@@ -69,6 +72,7 @@ public:
         menuBar->addAction(menuTool->menuAction());
         menuFile->addAction(actionExit);
         menuTool->addAction(actionTrainByECP);
+        menuTool->addAction(actionCancel);
         menuTool->addAction(actionDecisionTreeTest);
 
         retranslateUi(MainWindowClass);
@@ -82,6 +86,7 @@ public:
         actionExit->setText(QApplication::translate("MainWindowClass", "Exit", 0));
         actionTrainByECP->setText(QApplication::translate("MainWindowClass", "Train by ECP", 0));
         actionDecisionTreeTest->setText(QApplication::translate("MainWindowClass", "Decision Tree Test", 0));
+        actionCancel->setText(QApplication::translate("MainWindowClass", "Cancel", 0));
         menuFile->setTitle(QApplication::translate("MainWindowClass", "File", 0));
         menuTool->setTitle(QApplication::translate("MainWindowClass", "Tool", 0));
     } // retranslateUi
@@ -2,21 +2,57 @@
 #define MAINWINDOW_H
 
 #include <QtWidgets/QMainWindow>
+#include <QTimer>
+#include <atomic>
+#include <mutex>
+#include <thread>
 #include "ui_MainWindow.h"
+#include "RandomForest.h"
+
+/**
+ * Keeps the latest progress reported by the training worker, and the error it failed with, if any,
+ * so that the GUI thread can poll them.
+ */
+class TrainingMonitor : public rf::ProgressMonitor {
+private:
+	std::mutex mutex;
+	rf::Progress progress;
+	std::string error_message;
+	std::atomic<bool> cancelled;
+
+public:
+	TrainingMonitor();
+
+	void onProgress(const rf::Progress& progress);
+	bool isCancelled();
+	void cancel();
+	void reset();
+	void fail(const std::string& message);
+	rf::Progress latest();
+	std::string error();
+};
 
 class MainWindow : public QMainWindow {
 	Q_OBJECT
 
 private:
 	Ui::MainWindowClass ui;
+	std::thread worker;
+	std::atomic<bool> worker_finished;
+	TrainingMonitor monitor;
+	QTimer progress_timer;
 
 public:
 	MainWindow(QWidget *parent = 0);
 	~MainWindow();
 
+protected:
+	void closeEvent(QCloseEvent* event);
 
 public slots:
 	void onTrainByECP();
+	void onCancel();
+	void onProgressTimer();
 	void onDecisionTreeTest();
 };
 
@@ -0,0 +1,208 @@
+#include "MemoryStats.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#endif
+
+#ifdef _MSC_VER
+#define RF_THREAD_LOCAL __declspec(thread)
+#else
+#define RF_THREAD_LOCAL thread_local
+#endif
+
+namespace rf {
+
+	namespace {
+		std::atomic<long long> num_allocations(0);
+		std::atomic<long long> num_allocated_bytes(0);
+		std::atomic<long long> num_current_bytes(0);
+		std::atomic<long long> num_peak_bytes(0);
+
+		// the same counts for the calling thread only
+		RF_THREAD_LOCAL long long thread_allocations = 0;
+		RF_THREAD_LOCAL long long thread_allocated_bytes = 0;
+		RF_THREAD_LOCAL long long thread_current_bytes = 0;
+		RF_THREAD_LOCAL long long thread_peak_bytes = 0;
+	}
+
+#ifdef RF_MEMORY_STATS
+	namespace {
+		// the requested size is stored in front of every block so that delete can account for it
+		const size_t HEADER_SIZE = 16;
+
+		void* countedAlloc(size_t size) {
+			void* block = std::malloc(size + HEADER_SIZE);
+			if (!block) return NULL;
+			*(size_t*)block = size;
+
+			num_allocations++;
+			num_allocated_bytes += size;
+			long long current = (num_current_bytes += size);
+			long long peak = num_peak_bytes;
+			while (current > peak && !num_peak_bytes.compare_exchange_weak(peak, current));
+
+			thread_allocations++;
+			thread_allocated_bytes += size;
+			thread_current_bytes += size;
+			if (thread_current_bytes > thread_peak_bytes) thread_peak_bytes = thread_current_bytes;
+
+			return (char*)block + HEADER_SIZE;
+		}
+
+		void countedFree(void* ptr) {
+			if (!ptr) return;
+			void* block = (char*)ptr - HEADER_SIZE;
+			num_current_bytes -= *(size_t*)block;
+			thread_current_bytes -= *(size_t*)block;
+			std::free(block);
+		}
+	}
+#endif
+
+	long long MemoryStats::allocations() {
+		return num_allocations;
+	}
+
+	long long MemoryStats::allocatedBytes() {
+		return num_allocated_bytes;
+	}
+
+	long long MemoryStats::currentBytes() {
+		return num_current_bytes;
+	}
+
+	long long MemoryStats::peakBytes() {
+		return num_peak_bytes;
+	}
+
+	/**
+	 * Return the peak resident set size of this process in bytes, or 0 if it is not available.
+	 */
+	long long MemoryStats::peakRSS() {
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+		if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+		return counters.PeakWorkingSetSize;
+#else
+		FILE* fp = fopen("/proc/self/status", "r");
+		if (!fp) return 0;
+
+		long long kb = 0;
+		char line[256];
+		while (fgets(line, sizeof(line), fp)) {
+			if (strncmp(line, "VmHWM:", 6) == 0) {
+				kb = atoll(line + 6);
+				break;
+			}
+		}
+		fclose(fp);
+
+		return kb * 1024;
+#endif
+	}
+
+	MemoryPhase::MemoryPhase(const std::string& name, bool this_thread) {
+		this->name = name;
+		this->this_thread = this_thread;
+
+		// track the peak of this phase only, and restore the enclosing phase's peak at the end
+		if (this_thread) {
+			start_allocations = thread_allocations;
+			start_allocated_bytes = thread_allocated_bytes;
+			start_current_bytes = thread_current_bytes;
+			saved_peak_bytes = thread_peak_bytes;
+			thread_peak_bytes = start_current_bytes;
+		}
+		else {
+			start_allocations = num_allocations;
+			start_allocated_bytes = num_allocated_bytes;
+			start_current_bytes = num_current_bytes;
+			saved_peak_bytes = num_peak_bytes.exchange(start_current_bytes);
+		}
+		running = true;
+	}
+
+	MemoryPhase::~MemoryPhase() {
+		end();
+	}
+
+	void MemoryPhase::end() {
+		if (!running) return;
+		running = false;
+
+		if (this_thread) {
+			long long peak = thread_peak_bytes;
+			if (saved_peak_bytes > peak) thread_peak_bytes = saved_peak_bytes;
+
+#ifdef RF_MEMORY_STATS
+			const double MB = 1024.0 * 1024.0;
+			printf("[memory] %s (thread): %lld allocs, %.1f MB allocated, %+.1f MB net, heap peak %+.1f MB\n",
+				name.c_str(),
+				thread_allocations - start_allocations,
+				(thread_allocated_bytes - start_allocated_bytes) / MB,
+				(thread_current_bytes - start_current_bytes) / MB,
+				(peak - start_current_bytes) / MB);
+#endif
+			return;
+		}
+
+		long long peak = num_peak_bytes;
+		if (saved_peak_bytes > peak) num_peak_bytes = saved_peak_bytes;
+
+#ifdef RF_MEMORY_STATS
+		const double MB = 1024.0 * 1024.0;
+		printf("[memory] %s: %lld allocs, %.1f MB allocated, %+.1f MB net, heap peak %.1f MB, peak RSS %.1f MB\n",
+			name.c_str(),
+			(long long)num_allocations - start_allocations,
+			(num_allocated_bytes - start_allocated_bytes) / MB,
+			(num_current_bytes - start_current_bytes) / MB,
+			peak / MB,
+			MemoryStats::peakRSS() / MB);
+#endif
+	}
+
+}
+
+#ifdef RF_MEMORY_STATS
+void* operator new(size_t size) {
+	void* ptr = rf::countedAlloc(size);
+	if (!ptr) throw std::bad_alloc();
+	return ptr;
+}
+
+void* operator new[](size_t size) {
+	void* ptr = rf::countedAlloc(size);
+	if (!ptr) throw std::bad_alloc();
+	return ptr;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) throw() {
+	return rf::countedAlloc(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) throw() {
+	return rf::countedAlloc(size);
+}
+
+void operator delete(void* ptr) throw() {
+	rf::countedFree(ptr);
+}
+
+void operator delete[](void* ptr) throw() {
+	rf::countedFree(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) throw() {
+	rf::countedFree(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) throw() {
+	rf::countedFree(ptr);
+}
+#endif
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+
+namespace rf {
+	/**
+	 * Heap accounting for the training pipeline.
+	 * When built with RF_MEMORY_STATS, the global operator new/delete are replaced by
+	 * counting versions, and every MemoryPhase reports its allocation count, allocated
+	 * bytes, heap peak and the peak RSS of the process when it ends.
+	 * A phase of this_thread counts only the allocations of the thread that runs it, so that
+	 * work done on several threads at once, such as the trees of a forest, is reported apart.
+	 * Its heap peak is relative to the start of the phase, and memory freed by another
+	 * thread is not subtracted. Without the flag, the phases do nothing.
+	 */
+	class MemoryStats {
+	public:
+		static long long allocations();
+		static long long allocatedBytes();
+		static long long currentBytes();
+		static long long peakBytes();
+		static long long peakRSS();
+	};
+
+	class MemoryPhase {
+	private:
+		std::string name;
+		long long start_allocations;
+		long long start_allocated_bytes;
+		long long start_current_bytes;
+		long long saved_peak_bytes;
+		bool this_thread;
+		bool running;
+
+	public:
+		MemoryPhase(const std::string& name, bool this_thread = false);
+		~MemoryPhase();
+
+		void end();
+	};
+
+}
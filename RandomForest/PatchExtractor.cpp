@@ -0,0 +1,103 @@
+#include "PatchExtractor.h"
+#include "ECPPipeline.h"
+#include <cstring>
+
+/**
+ * Quantize the intensity of a color to one of 10 levels.
+ */
+unsigned char quantizeColor(const cv::Vec3b& color) {
+	float val = ((float)color[0] + (float)color[1] + (float)color[2]) / 3.0f / 25.6;
+	if (val >= 10) val = 9;
+	if (val < 0) val = 0;
+
+	return val;
+}
+
+/**
+ * Quantize every pixel of the image, so that the attributes of any patch can be read from the result.
+ */
+cv::Mat quantizeImage(const cv::Mat& image) {
+	cv::Mat quantized(image.size(), CV_8U);
+	for (int y = 0; y < image.rows; ++y) {
+		for (int x = 0; x < image.cols; ++x) {
+			quantized.at<unsigned char>(y, x) = quantizeColor(image.at<cv::Vec3b>(y, x));
+		}
+	}
+	return quantized;
+}
+
+/**
+ * Return the offset of every attribute of a patch from the patch's top-left pixel in a quantized image
+ * whose rows are row_step bytes apart. The attributes are in the order of extractExampleFromPatch.
+ */
+std::vector<int> patchAttributeOffsets(int patch_size, int row_step) {
+	std::vector<int> offsets(patch_size * patch_size);
+	for (int index = 0; index < patch_size * patch_size; ++index) {
+		offsets[index] = index / patch_size * row_step + index % patch_size;
+	}
+	return offsets;
+}
+
+PatchExtractor::PatchExtractor(int patch_size, int stride) {
+	this->patch_size = patch_size;
+	this->stride = stride;
+}
+
+void PatchExtractor::setImage(const cv::Mat& image) {
+	quantized = quantizeImage(image);
+	attribute_offsets = patchAttributeOffsets(patch_size, quantized.step);
+}
+
+int PatchExtractor::numRows() const {
+	if (quantized.rows < patch_size) return 0;
+	return (quantized.rows - patch_size) / stride + 1;
+}
+
+int PatchExtractor::numColumns() const {
+	if (quantized.cols < patch_size) return 0;
+	return (quantized.cols - patch_size) / stride + 1;
+}
+
+/**
+ * Return the pixel at the center of a patch, which the patch is labelled for.
+ */
+cv::Point PatchExtractor::center(int row, int column) const {
+	return cv::Point(column * stride + (patch_size - 1) / 2, row * stride + (patch_size - 1) / 2);
+}
+
+/**
+ * Copy the attributes of the patches of a row to data, numColumns() rows of patch_size * patch_size values.
+ * Each patch is patch_size contiguous runs of the quantized image.
+ */
+void PatchExtractor::extractRow(int row, unsigned char* data) const {
+	int num_columns = numColumns();
+	for (int y = 0; y < patch_size; ++y) {
+		const unsigned char* line = quantized.ptr<unsigned char>(row * stride + y);
+		for (int column = 0; column < num_columns; ++column) {
+			memcpy(data + (column * patch_size + y) * patch_size, line + column * stride, patch_size);
+		}
+	}
+}
+
+/**
+ * Copy the attributes of the patches of a row to data, and their labels, taken from the ground truth color
+ * at their centers, to labels.
+ */
+void PatchExtractor::extractRow(int row, const cv::Mat& ground_truth, unsigned char* data, unsigned char* labels) const {
+	extractRow(row, data);
+	for (int column = 0; column < numColumns(); ++column) {
+		labels[column] = convertColorToLabel(ground_truth.at<cv::Vec3b>(center(row, column)));
+	}
+}
+
+/**
+ * Append the labelled patches of a row to the dataset.
+ */
+void PatchExtractor::extractRow(int row, const cv::Mat& ground_truth, rf::Dataset& dataset) const {
+	int num_columns = numColumns();
+	std::vector<unsigned char> data(num_columns * patch_size * patch_size);
+	std::vector<unsigned char> labels(num_columns);
+	extractRow(row, ground_truth, data.data(), labels.data());
+
+	dataset.append(data.data(), labels.data(), num_columns);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "RandomForest.h"
+
+unsigned char quantizeColor(const cv::Vec3b& color);
+cv::Mat quantizeImage(const cv::Mat& image);
+std::vector<int> patchAttributeOffsets(int patch_size, int row_step);
+
+/**
+ * Enumerates the square patches of an image row by row. The image is quantized once when it is set,
+ * and the patches of a row are then copied out of the quantized image in bulk, or read in place through
+ * the attribute offsets. Patches start every stride pixels in both directions.
+ */
+class PatchExtractor {
+public:
+	int patch_size;
+	int stride;
+	cv::Mat quantized;
+	std::vector<int> attribute_offsets;
+
+public:
+	PatchExtractor(int patch_size, int stride = 1);
+
+	void setImage(const cv::Mat& image);
+	int numRows() const;
+	int numColumns() const;
+	cv::Point center(int row, int column) const;
+	const unsigned char* rowData(int row) const { return quantized.ptr<unsigned char>(row * stride); }
+	void extractRow(int row, unsigned char* data) const;
+	void extractRow(int row, const cv::Mat& ground_truth, unsigned char* data, unsigned char* labels) const;
+	void extractRow(int row, const cv::Mat& ground_truth, rf::Dataset& dataset) const;
+};
@@ -1,58 +1,1935 @@
 #include "RandomForest.h"
+#include "MemoryStats.h"
+#include "TreeKernels.h"
 #include <algorithm>
 #include <numeric>
 #include <random>
+#include <chrono>
+#include <sstream>
+#include <iomanip>
 #include <QFile>
 #include <QTextStream>
 #include <iostream>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+#include <unordered_set>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <exception>
+#include <map>
+#include <queue>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <immintrin.h>
+#endif
 
 namespace rf {
 
-	DecisionTreeNode::DecisionTreeNode(int depth) {
-		this->depth = depth;
+	TreeStats::TreeStats() {
+		num_nodes = 0;
+		num_stored_nodes = 0;
+		num_leaves = 0;
+		num_children = 0;
+		max_depth = 0;
+		num_leaf_examples = 0;
+		min_leaf_examples = std::numeric_limits<int>::max();
+		max_leaf_examples = 0;
+		num_single_example_leaves = 0;
+		leaf_purity_sum = 0.0;
+		bytes = 0;
+		memset(stops, 0, sizeof(stops));
+	}
+
+	std::string TreeStats::stopReasonName(int reason) {
+		static const char* names[NUM_STOP_REASONS] = { "pure", "max depth", "min samples split", "min samples leaf", "min gain", "max leaf nodes", "budget", "no split" };
+		return names[reason];
+	}
+
+	void TreeStats::addNode(int depth, int num_children) {
+		num_nodes++;
+		this->num_children += num_children;
+		max_depth = std::max(max_depth, depth);
+	}
+
+	void TreeStats::addLeaf(int depth, int num_examples, float purity) {
+		num_leaves++;
+		if (leaf_depth_histogram.size() <= depth) {
+			leaf_depth_histogram.resize(depth + 1, 0);
+		}
+		leaf_depth_histogram[depth]++;
+		num_leaf_examples += num_examples;
+		min_leaf_examples = std::min(min_leaf_examples, num_examples);
+		max_leaf_examples = std::max(max_leaf_examples, num_examples);
+		if (num_examples == 1) num_single_example_leaves++;
+		leaf_purity_sum += purity;
+	}
+
+	void TreeStats::merge(const TreeStats& other) {
+		num_nodes += other.num_nodes;
+		num_stored_nodes += other.num_stored_nodes;
+		num_leaves += other.num_leaves;
+		num_children += other.num_children;
+		max_depth = std::max(max_depth, other.max_depth);
+		if (leaf_depth_histogram.size() < other.leaf_depth_histogram.size()) {
+			leaf_depth_histogram.resize(other.leaf_depth_histogram.size(), 0);
+		}
+		for (int i = 0; i < other.leaf_depth_histogram.size(); ++i) {
+			leaf_depth_histogram[i] += other.leaf_depth_histogram[i];
+		}
+		num_leaf_examples += other.num_leaf_examples;
+		min_leaf_examples = std::min(min_leaf_examples, other.min_leaf_examples);
+		max_leaf_examples = std::max(max_leaf_examples, other.max_leaf_examples);
+		num_single_example_leaves += other.num_single_example_leaves;
+		leaf_purity_sum += other.leaf_purity_sum;
+		bytes += other.bytes;
+		for (int i = 0; i < NUM_STOP_REASONS; ++i) {
+			stops[i] += other.stops[i];
+		}
+	}
+
+	float TreeStats::branchingFactor() const {
+		int num_internal_nodes = num_nodes - num_leaves;
+		if (num_internal_nodes == 0) return 0.0f;
+		return (float)num_children / num_internal_nodes;
+	}
+
+	float TreeStats::averageLeafExamples() const {
+		if (num_leaves == 0) return 0.0f;
+		return (float)num_leaf_examples / num_leaves;
+	}
+
+	float TreeStats::averageLeafPurity() const {
+		if (num_leaves == 0) return 0.0f;
+		return leaf_purity_sum / num_leaves;
+	}
+
+	void ForestStats::print() const {
+		printf("Tree   #nodes  #stored  #leaves  depth  branching  leaf examples (min/avg/max)  single-example leaves  purity     KB\n");
+		for (int i = 0; i < trees.size(); ++i) {
+			const TreeStats& s = trees[i];
+			printf("%4d %8d %8d %8d %6d %10.2f %10d / %8.1f / %8d %22d %7.3f %6d\n", i + 1, s.num_nodes, s.num_stored_nodes, s.num_leaves, s.max_depth, s.branchingFactor(), s.min_leaf_examples, s.averageLeafExamples(), s.max_leaf_examples, s.num_single_example_leaves, s.averageLeafPurity(), (int)(s.bytes / 1024));
+		}
+		printf("Total %8d %8d %8d %6d %10.2f %10d / %8.1f / %8d %22d %7.3f %6d\n", total.num_nodes, total.num_stored_nodes, total.num_leaves, total.max_depth, total.branchingFactor(), total.min_leaf_examples, total.averageLeafExamples(), total.max_leaf_examples, total.num_single_example_leaves, total.averageLeafPurity(), (int)(total.bytes / 1024));
+
+		printf("Leaf depth histogram:\n");
+		for (int d = 0; d < total.leaf_depth_histogram.size(); ++d) {
+			if (total.leaf_depth_histogram[d] == 0) continue;
+			printf("%4d: %d\n", d, total.leaf_depth_histogram[d]);
+		}
+
+		printf("Stopped by:");
+		for (int i = 0; i < TreeStats::NUM_STOP_REASONS; ++i) {
+			printf("%s %s %lld", i > 0 ? "," : "", TreeStats::stopReasonName(i).c_str(), total.stops[i]);
+		}
+		printf("\n");
+	}
+
+	ConstructionStats::ConstructionStats() {
+		memset(stops, 0, sizeof(stops));
+	}
+
+	void FeatureImportance::resize(int num_attributes) {
+		split_counts.assign(num_attributes, 0);
+		gains.assign(num_attributes, 0.0);
+	}
+
+	void FeatureImportance::addSplit(int attribute, double gain) {
+		split_counts[attribute]++;
+		gains[attribute] += gain;
+	}
+
+	void FeatureImportance::merge(const FeatureImportance& other) {
+		if (split_counts.size() < other.split_counts.size()) {
+			split_counts.resize(other.split_counts.size(), 0);
+			gains.resize(other.gains.size(), 0.0);
+		}
+		for (int i = 0; i < other.split_counts.size(); ++i) {
+			split_counts[i] += other.split_counts[i];
+			gains[i] += other.gains[i];
+		}
+	}
+
+	/**
+	 * Print the share of the splits and of the gain of every attribute in percent, as maps of width columns,
+	 * which for patch attributes are heat maps over the patch.
+	 */
+	void FeatureImportance::print(int width) const {
+		long long total_splits = std::accumulate(split_counts.begin(), split_counts.end(), 0LL);
+		double total_gain = std::accumulate(gains.begin(), gains.end(), 0.0);
+
+		printf("Splits per attribute (%%):\n");
+		for (int i = 0; i < split_counts.size(); ++i) {
+			printf("%6.2f", total_splits > 0 ? 100.0 * split_counts[i] / total_splits : 0.0);
+			if ((i + 1) % width == 0 || i + 1 == split_counts.size()) printf("\n");
+		}
+
+		printf("Entropy reduction per attribute (%%):\n");
+		for (int i = 0; i < gains.size(); ++i) {
+			printf("%6.2f", total_gain > 0 ? 100.0 * gains[i] / total_gain : 0.0);
+			if ((i + 1) % width == 0 || i + 1 == gains.size()) printf("\n");
+		}
+	}
+
+	/**
+	 * Return the total weight of the examples labelled by at least one tree.
+	 */
+	double OOBEstimate::numExamples() const {
+		return std::accumulate(confusion.begin(), confusion.end(), 0.0);
+	}
+
+	float OOBEstimate::error() const {
+		double num_examples = numExamples();
+		if (num_examples == 0) return 0.0f;
+
+		double num_correct = 0;
+		for (int label = 0; label < Example::NUM_LABELS; ++label) {
+			num_correct += confusion[label * Example::NUM_LABELS + label];
+		}
+		return (float)(1.0 - num_correct / num_examples);
+	}
+
+	void OOBEstimate::print() const {
+		printf("Out-of-bag error: %.4f over %.0f examples\n", error(), numExamples());
+		printf("Out-of-bag error by #trees:\n");
+		for (int i = 0; i < error_curve.size(); ++i) {
+			printf("%4d: %.4f\n", i + 1, error_curve[i]);
+		}
+
+		// every row is normalized by the weight of its true label
+		printf("Out-of-bag confusion matrix:\n");
+		for (int truth = 0; truth < Example::NUM_LABELS; ++truth) {
+			const double* row = &confusion[truth * Example::NUM_LABELS];
+			double total = std::accumulate(row, row + Example::NUM_LABELS, 0.0);
+			if (total == 0) continue;
+
+			printf("%4d:", truth);
+			for (int label = 0; label < Example::NUM_LABELS; ++label) {
+				printf(" %.3f", row[label] / total);
+			}
+			printf("\n");
+		}
+	}
+
+	Progress::Progress(const std::string& stage) {
+		this->stage = stage;
+		num_trees = 0;
+		num_trees_built = 0;
+		num_examples_processed = 0;
+		num_nodes_built = 0;
+		fraction = 0.0f;
+		seconds_remaining = -1.0f;
+		oob_error = -1.0f;
+	}
+
+	std::string Progress::toString() const {
+		std::ostringstream out;
+		out << stage << ": " << (int)(fraction * 100) << "%";
+		if (num_trees > 0) out << ", tree " << std::min(num_trees_built + 1, num_trees) << "/" << num_trees;
+		out << ", " << num_examples_processed << " examples";
+		if (num_nodes_built > 0) out << ", " << num_nodes_built << " nodes";
+		if (oob_error >= 0) out << ", OOB error " << std::fixed << std::setprecision(4) << oob_error << std::defaultfloat;
+		if (seconds_remaining >= 0) {
+			int seconds = (int)seconds_remaining;
+			out << ", ETA " << seconds / 3600 << ":" << std::setfill('0') << std::setw(2) << seconds / 60 % 60 << ":" << std::setw(2) << seconds % 60;
+		}
+		return out.str();
+	}
+
+	/**
+	 * Thrown from inside the recursive construction when the monitor requests cancellation.
+	 */
+	class Cancelled {};
+
+	/**
+	 * Counts the work done while building trees, and forwards throttled reports to a monitor.
+	 * The work of a tree is the number of examples visited over all of its nodes. Until the first
+	 * tree is done, it is bounded by the subset size times the maximum depth.
+	 * Trees may be built concurrently, so the counters are atomic and the reports are serialized.
+	 */
+	class ProgressTracker {
+	private:
+		ProgressMonitor* monitor;
+		std::mutex mutex;
+		Progress progress;
+		std::chrono::steady_clock::time_point start;
+		std::atomic<long long> num_nodes_built;
+		std::atomic<long long> num_examples_processed;
+		long long expected_tree_work;
+		long long completed_work;
+
+	public:
+		ProgressTracker(ProgressMonitor* monitor, int num_trees, long long expected_tree_work) : progress("training"), num_nodes_built(0), num_examples_processed(0) {
+			this->monitor = monitor;
+			progress.num_trees = num_trees;
+			start = std::chrono::steady_clock::now();
+			this->expected_tree_work = std::max(1LL, expected_tree_work);
+			completed_work = 0;
+		}
+
+		void nodeBuilt(int num_examples) {
+			long long num_nodes = ++num_nodes_built;
+			num_examples_processed += num_examples;
+
+			checkCancelled();
+			if (num_nodes % 256 == 0) {
+				std::lock_guard<std::mutex> lock(mutex);
+				report();
+			}
+		}
+
+		void checkCancelled() {
+			if (monitor->isCancelled()) throw Cancelled();
+		}
+
+		void treeBuilt(long long tree_work) {
+			std::lock_guard<std::mutex> lock(mutex);
+			progress.num_trees_built++;
+			completed_work += tree_work;
+			expected_tree_work = std::max(1LL, completed_work / progress.num_trees_built);
+			report();
+		}
+
+		void oobEstimated(float error) {
+			std::lock_guard<std::mutex> lock(mutex);
+			progress.oob_error = error;
+		}
+
+	private:
+		void report() {
+			// the work of the trees in progress is what has been done beyond the completed trees
+			long long work_in_progress = num_examples_processed - completed_work;
+			float tree_fraction = std::min(0.99f * (progress.num_trees - progress.num_trees_built), (float)work_in_progress / expected_tree_work);
+			progress.fraction = (progress.num_trees_built + tree_fraction) / progress.num_trees;
+			progress.num_nodes_built = num_nodes_built;
+			progress.num_examples_processed = num_examples_processed;
+
+			float elapsed = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+			if (progress.fraction > 0) {
+				progress.seconds_remaining = elapsed * (1.0f - progress.fraction) / progress.fraction;
+			}
+
+			monitor->onProgress(progress);
+		}
+	};
+
+	/**
+	 * Votes of one tree for an example it did not draw. fraction is the expected fraction of the example's
+	 * identical copies that the tree did not draw, and scales the vote.
+	 */
+	class OOBVote {
+	public:
+		unsigned int row;
+		int node_id;
+		float fraction;
+	};
+
+	/**
+	 * Out-of-bag votes of a forest under construction. The trees may be built in any order, but their
+	 * votes are merged in tree order, so the error curve does not depend on the number of threads.
+	 * When every vote is a whole hard vote (no priors, no leaf histograms and no row weights), the votes
+	 * are counted in 16 bits instead of summed as floats.
+	 */
+	class OOBAccumulator {
+	public:
+		std::mutex mutex;
+		std::vector<float> votes;						// Example::NUM_LABELS per dataset row, or empty if counts is used
+		std::vector<unsigned short> counts;				// Example::NUM_LABELS per dataset row, or empty if votes is used
+		std::vector<unsigned char> labels;				// the label of every row, or Example::NUM_LABELS while it has no votes
+		std::map<int, std::vector<OOBVote> > pending;	// votes of the trees built ahead of the next one to merge
+		int num_merged;
+		OOBEstimate estimate;
+
+	public:
+		OOBAccumulator(const Dataset& dataset, const TrainingParams& params) : labels(dataset.size(), Example::NUM_LABELS) {
+			if (params.priors.size() == 0 && !params.leaf_histograms && dataset.weights.size() == 0 && params.num_trees <= 0xffff) {
+				counts.resize(dataset.size() * Example::NUM_LABELS, 0);
+			}
+			else {
+				votes.resize(dataset.size() * Example::NUM_LABELS, 0.0f);
+			}
+			estimate.confusion.assign(Example::NUM_LABELS * Example::NUM_LABELS, 0.0);
+			num_merged = 0;
+		}
+	};
+
+	/**
+	 * Return the label with the most votes, the first one on ties, or Example::NUM_LABELS if there are no votes.
+	 */
+	template<typename T>
+	static unsigned char votedLabel(const T* votes) {
+		unsigned char label = Example::NUM_LABELS;
+		T max_votes = 0;
+		for (int i = 0; i < Example::NUM_LABELS; ++i) {
+			if (votes[i] > max_votes) {
+				max_votes = votes[i];
+				label = i;
+			}
+		}
+		return label;
+	}
+
+	/**
+	 * splitmix64 finalizer, used to derive independent random numbers from counters.
+	 */
+	static inline unsigned long long mixBits(unsigned long long x) {
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+		return x ^ (x >> 31);
+	}
+
+	/**
+	 * Return a uniform number in [0, 1) that depends only on the stream key, the row and the draw,
+	 * so the sample of a tree can be generated in any order and on any thread.
+	 */
+	static inline double counterUniform(unsigned long long key, unsigned int row, int draw) {
+		unsigned long long bits = mixBits(key + ((unsigned long long)row << 2 | draw) * 0x9e3779b97f4a7c15ULL);
+		return (bits >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+	/**
+	 * Draw from a Poisson distribution with the given mean by inverting its distribution function,
+	 * or from the normal approximation for large means.
+	 */
+	static unsigned int drawPoisson(double mean, double u, double u2) {
+		if (mean > 30.0) {
+			double z = sqrt(-2.0 * log(1.0 - u)) * cos(6.283185307179586 * u2);
+			return (unsigned int)std::max(0.0, floor(mean + sqrt(mean) * z + 0.5));
+		}
+
+		double p = exp(-mean);
+		double cumulative = p;
+		unsigned int k = 0;
+		while (u >= cumulative && p > 0) {
+			k++;
+			p *= mean / k;
+			cumulative += p;
+		}
+		return k;
+	}
+
+	/**
+	 * Draw from a binomial distribution of n trials with success probability p by inverting its distribution
+	 * function, or from the normal approximation when its variance is large. For p above one half, the
+	 * failures are drawn instead, so that the probability of no success never underflows.
+	 */
+	static unsigned int drawBinomial(unsigned int n, double p, double u, double u2) {
+		if (p > 0.5) return n - drawBinomial(n, 1.0 - p, u, u2);
+
+		double mean = n * p;
+		double variance = mean * (1.0 - p);
+		if (variance > 30.0) {
+			double z = sqrt(-2.0 * log(1.0 - u)) * cos(6.283185307179586 * u2);
+			return (unsigned int)std::min((double)n, std::max(0.0, floor(mean + sqrt(variance) * z + 0.5)));
+		}
+
+		double q = pow(1.0 - p, (double)n);
+		double cumulative = q;
+		unsigned int k = 0;
+		while (u >= cumulative && k < n) {
+			q *= (double)(n - k) / (k + 1) * p / (1.0 - p);
+			k++;
+			cumulative += q;
+		}
+		return k;
+	}
+
+	RowSample::RowSample(const unsigned int* weights, size_t num_rows) {
+		this->weights = weights;
+		key = 0;
+		poisson_bagging = false;
+		ratio = 1.0f;
+		this->num_rows = num_rows;
+		restart();
+	}
+
+	/**
+	 * The sample of the tree_id-th tree drawn from num_rows unweighted rows, see drawSample.
+	 */
+	RowSample::RowSample(const TrainingParams& params, int tree_id, size_t num_rows) {
+		weights = NULL;
+		key = mixBits(((unsigned long long)params.seed << 32) + tree_id);
+		poisson_bagging = params.poisson_bagging;
+		ratio = params.ratio;
+		this->num_rows = num_rows;
+		restart();
+	}
+
+	void RowSample::restart() {
+		row = 0;
+		needed = (long long)(num_rows * ratio);
+	}
+
+	/**
+	 * Return the weight of the next row. Without poisson_bagging, the rows are selected in a single pass
+	 * (selection sampling), so the weight of a row depends on the rows before it.
+	 */
+	unsigned int RowSample::next() {
+		unsigned int r = row++;
+		if (weights) return weights[r];
+		if (poisson_bagging) return drawPoisson(ratio, counterUniform(key, r, 0), counterUniform(key, r, 1));
+		if (needed <= 0 || counterUniform(key, r, 0) * (num_rows - r) >= needed) return 0;
+
+		needed--;
+		return 1;
+	}
+
+	Dataset::Dataset(int num_attributes) {
+		this->num_attributes = num_attributes;
+		num_values = 0;
+	}
+
+	void Dataset::push_back(const Example& example) {
+		if (example.data.size() != num_attributes) throw "Example has a wrong number of attributes.";
+
+		data.insert(data.end(), example.data.begin(), example.data.end());
+		labels.push_back(example.label);
+		if (weights.size() > 0) weights.push_back(1);
+		for (int i = 0; i < example.data.size(); ++i) {
+			num_values = std::max(num_values, example.data[i] + 1);
+		}
+	}
+
+	/**
+	 * Append count examples stored row by row in data, with their labels.
+	 */
+	void Dataset::append(const unsigned char* data, const unsigned char* labels, int count) {
+		size_t begin = this->data.size();
+		this->data.insert(this->data.end(), data, data + (size_t)count * num_attributes);
+		this->labels.insert(this->labels.end(), labels, labels + count);
+		if (weights.size() > 0) weights.resize(this->labels.size(), 1);
+		for (size_t i = begin; i < this->data.size(); ++i) {
+			num_values = std::max(num_values, this->data[i] + 1);
+		}
+	}
+
+	long long Dataset::totalWeight() const {
+		if (weights.size() == 0) return labels.size();
+
+		long long total = 0;
+		for (size_t i = 0; i < weights.size(); ++i) {
+			total += weights[i];
+		}
+		return total;
+	}
+
+	/**
+	 * Hashes the attribute values and the label of a row of a dataset.
+	 */
+	class RowHash {
+	private:
+		const Dataset* dataset;
+
+	public:
+		RowHash(const Dataset* dataset) : dataset(dataset) {}
+
+		size_t operator()(unsigned int index) const {
+			// FNV-1a
+			unsigned long long hash = 14695981039346656037ULL;
+			const unsigned char* row = dataset->row(index);
+			for (int i = 0; i < dataset->num_attributes; ++i) {
+				hash = (hash ^ row[i]) * 1099511628211ULL;
+			}
+			return (hash ^ dataset->labels[index]) * 1099511628211ULL;
+		}
+	};
+
+	class RowEqual {
+	private:
+		const Dataset* dataset;
+
+	public:
+		RowEqual(const Dataset* dataset) : dataset(dataset) {}
+
+		bool operator()(unsigned int a, unsigned int b) const {
+			return dataset->labels[a] == dataset->labels[b] && memcmp(dataset->row(a), dataset->row(b), dataset->num_attributes) == 0;
+		}
+	};
+
+	/**
+	 * Merge the rows from begin on that have the same attribute values and label into one row,
+	 * whose weight is the sum of theirs. The rows before begin are left as they are, so that the
+	 * rows of each image can be merged as they are added, and all of them once at the end.
+	 */
+	void Dataset::deduplicate(size_t begin) {
+		if (weights.size() == 0) weights.assign(labels.size(), 1);
+
+		// the unique rows are moved to the front of the range, and the set refers to them by index
+		std::unordered_set<unsigned int, RowHash, RowEqual> unique_rows(16, RowHash(this), RowEqual(this));
+		size_t num_unique = begin;
+		for (size_t i = begin; i < labels.size(); ++i) {
+			if (num_unique != i) {
+				memcpy(&data[num_unique * num_attributes], &data[i * num_attributes], num_attributes);
+				labels[num_unique] = labels[i];
+				weights[num_unique] = weights[i];
+			}
+
+			auto inserted = unique_rows.insert(num_unique);
+			if (inserted.second) {
+				num_unique++;
+			}
+			else {
+				weights[*inserted.first] += weights[num_unique];
+			}
+		}
+
+		data.resize(num_unique * num_attributes);
+		labels.resize(num_unique);
+		weights.resize(num_unique);
+	}
+
+	/**
+	 * Remove all the examples and release their memory.
+	 */
+	void Dataset::clear() {
+		std::vector<unsigned char>().swap(data);
+		std::vector<unsigned char>().swap(labels);
+		std::vector<unsigned int>().swap(weights);
+	}
+
+	TrainingParams::TrainingParams() {
+		num_trees = 10;
+		ratio = 0.5f;
+		max_depth = 18;
+		sample_attributes = true;
+		leaf_histograms = false;
+		split_type = SPLIT_MULTIWAY;
+		criterion = CRITERION_ENTROPY;
+		extra_trees = false;
+		num_random_splits = 1;
+		min_samples_split = 2;
+		min_samples_leaf = 1;
+		min_gain = 0.0f;
+		max_leaf_nodes = 0;
+		growth = GROWTH_DEPTH_FIRST;
+		max_nodes = 0;
+		max_bytes = 0;
+		poisson_bagging = false;
+		num_threads = 1;
+		seed = 0;
+		estimate_oob = false;
+	}
+
+	std::string TrainingParams::criterionName(int criterion) {
+		if (criterion == CRITERION_GINI) return "gini";
+		else if (criterion == CRITERION_ENTROPY_TABLE) return "entropy-table";
+		else return "entropy";
+	}
+
+	DecisionTreeNode::DecisionTreeNode() {
 		split_attribute_id = -1;
+		children_offset = -1;
 		label = Example::LABEL_UNKNOWN;
+		threshold = 0;
+		num_examples = 0;
+		purity = 1.0f;
+	}
+
+	/**
+	 * An in-memory dataset as a single block of rows, for the level-wise construction.
+	 */
+	class DatasetBlocks : public BlockSource {
+	private:
+		const Dataset& dataset;
+
+	public:
+		DatasetBlocks(const Dataset& dataset) : dataset(dataset) {}
+
+		size_t numRows() const { return dataset.size(); }
+		int numAttributes() const { return dataset.num_attributes; }
+		int numValues() const { return dataset.num_values; }
+		bool inMemory() const { return true; }
+
+		void scan(const std::function<void(const DataBlock&)>& visit) const {
+			DataBlock block;
+			block.data = dataset.data.data();
+			block.row_stride = dataset.num_attributes;
+			block.column_stride = 1;
+			block.labels = dataset.labels.data();
+			block.first_row = 0;
+			block.num_rows = dataset.size();
+			visit(block);
+		}
+	};
+
+	/**
+	 * The construction of a decision tree, with the state that the tree does not keep once it is built: the
+	 * generator that draws the attributes tried at every node, the partitioning buffers, and the counts that the
+	 * limits of TrainingParams are checked against. The nodes go straight into the arrays of the tree, whose
+	 * num_values and split_type are set before the builder is made.
+	 */
+	class TreeBuilder {
+	public:
+		DecisionTree& tree;
+		std::vector<DecisionTreeNode>& nodes;	// the arrays of the tree
+		std::vector<int>& children;
+		std::vector<unsigned char>& histograms;
+		int num_values;
+		int split_type;
+		std::mt19937 rng;						// draws the attributes tried at every node
+		std::vector<unsigned int> scratch;		// partitioning buffers
+		std::vector<unsigned int> weight_scratch;
+		ConstructionStats construction;			// the splits and the leaves made so far
+		int num_leaves_built;					// leaves so far, counting every child not built yet as one
+		int num_nodes_reserved;					// nodes so far, counting every child not built yet as one
+
+	public:
+		TreeBuilder(DecisionTree& tree, int num_attributes, const TrainingParams& params);
+
+		int numSlots() const { return tree.numSlots(); }
+		int slot(int node_id, int value) const { return tree.slot(node_id, value); }
+		int child(int node_id, int value) const { return tree.child(node_id, value); }
+		int constructNodes(const Dataset& dataset, unsigned int* indices, unsigned int* weights, int num_examples, int depth, const TrainingParams& params, ProgressTracker* tracker);
+		void constructBestFirst(const Dataset& dataset, unsigned int* indices, unsigned int* weights, int num_examples, const TrainingParams& params, ProgressTracker* tracker);
+		void constructLevelWise(const BlockSource& source, const RowSample& sample, const TrainingParams& params, ProgressTracker* tracker);
+
+	private:
+		int addNode(const Dataset& dataset, const unsigned int* indices, const unsigned int* weights, int num_examples, int depth, const TrainingParams& params, ProgressTracker* tracker, int& split_attribute, int& threshold, float& gain);
+		int addLeaf(const int* labels, int depth, const TrainingParams& params, ProgressTracker* tracker, bool& splittable);
+		bool acceptSplit(const int* labels, int total_weight, int best_attribute, float min_e, const TrainingParams& params, float& gain);
+		int splitNode(const Dataset& dataset, unsigned int* indices, unsigned int* weights, int num_examples, int node_id, int split_attribute, int threshold, float gain, const TrainingParams& params, int* begin, int* count);
+		int addChildren(int node_id, int split_attribute, int threshold, float gain, const int* slot_weights, const TrainingParams& params);
+		int countLabels(const Dataset& dataset, const unsigned int* indices, const unsigned int* weights, int num_examples, int split_attribute, int histogram[][Example::NUM_LABELS], int* count);
+		float calculateImpurity(const int histogram[][Example::NUM_LABELS], const int* count, int total_weight, const TrainingParams& params);
+		float calculateThresholdImpurity(const int histogram[][Example::NUM_LABELS], const int* count, int total_weight, const TrainingParams& params, int& threshold);
+		float calculateRandomSplitImpurity(const int histogram[][Example::NUM_LABELS], const int* count, int total_weight, const TrainingParams& params, int& threshold);
+	};
+
+	TreeBuilder::TreeBuilder(DecisionTree& tree, int num_attributes, const TrainingParams& params) : tree(tree), nodes(tree.nodes), children(tree.children), histograms(tree.histograms), rng(params.seed) {
+		num_values = tree.num_values;
+		split_type = tree.split_type;
+		construction.importance.resize(num_attributes);
+		num_leaves_built = 1;
+		num_nodes_reserved = 1;
+	}
+
+	DecisionTree::DecisionTree() {
+		num_values = 0;
+		split_type = TrainingParams::SPLIT_MULTIWAY;
+	}
+
+	/**
+	 * Build the tree from the examples of the dataset listed in indices. weights[i], if not NULL, is the number
+	 * of times indices[i] counts, and defaults to the dataset's own weights. The attributes tried at every node
+	 * are drawn from a generator seeded with params.seed. If construction is not NULL, it receives the splits and
+	 * the leaves the construction made.
+	 * Return false if the tracker's monitor cancelled the construction, in which case the tree is left empty.
+	 */
+	bool DecisionTree::construct(const Dataset& dataset, const std::vector<unsigned int>& indices, const TrainingParams& params, ProgressTracker* tracker, const unsigned int* weights, ConstructionStats* construction) {
+		if (params.growth == TrainingParams::GROWTH_LEVEL_WISE) {
+			std::vector<unsigned int> row_weights(dataset.size(), 0);
+			for (int i = 0; i < indices.size(); ++i) {
+				row_weights[indices[i]] += weights ? weights[i] : dataset.weight(indices[i]);
+			}
+			return construct(DatasetBlocks(dataset), RowSample(row_weights.data(), row_weights.size()), params, tracker, construction);
+		}
+
+		nodes.clear();
+		children.clear();
+		histograms.clear();
+		if (construction) *construction = ConstructionStats();
+		if (indices.size() == 0) return true;
+
+		// the attribute values are used as indices into the child table and the histograms
+		num_values = dataset.num_values;
+		split_type = params.split_type;
+		TreeBuilder builder(*this, dataset.num_attributes, params);
+
+		// the examples are partitioned in place as the tree grows
+		std::vector<unsigned int> working(indices);
+		std::vector<unsigned int> working_weights;
+		if (weights) {
+			working_weights.assign(weights, weights + indices.size());
+		}
+		else if (dataset.weights.size() > 0) {
+			working_weights.resize(indices.size());
+			for (int i = 0; i < indices.size(); ++i) {
+				working_weights[i] = dataset.weights[indices[i]];
+			}
+		}
+		builder.scratch.resize(indices.size());
+		builder.weight_scratch.resize(working_weights.size());
+
+		try {
+			unsigned int* working_weights_data = working_weights.size() > 0 ? working_weights.data() : NULL;
+			if (params.growth == TrainingParams::GROWTH_BEST_FIRST) {
+				builder.constructBestFirst(dataset, working.data(), working_weights_data, working.size(), params, tracker);
+			}
+			else {
+				builder.constructNodes(dataset, working.data(), working_weights_data, working.size(), 0, params, tracker);
+			}
+		}
+		catch (const Cancelled&) {
+			nodes.clear();
+			children.clear();
+			histograms.clear();
+			return false;
+		}
+		std::vector<unsigned int>().swap(builder.scratch);
+		std::vector<unsigned int>().swap(builder.weight_scratch);
+
+		// the arrays no longer grow, so drop their spare capacity
+		std::vector<DecisionTreeNode>(nodes).swap(nodes);
+		std::vector<int>(children).swap(children);
+		std::vector<unsigned char>(histograms).swap(histograms);
+
+		setLabelFromChildren(0, params.priors);
+		if (construction) *construction = builder.construction;
+
+		return true;
+	}
+
+	/**
+	 * Build the tree level by level from the rows of the source, where the sample gives the number of times
+	 * every row counts, or zero for the rows left out. See TreeBuilder::constructLevelWise.
+	 * Return false if the tracker's monitor cancelled the construction, in which case the tree is left empty.
+	 */
+	bool DecisionTree::construct(const BlockSource& source, const RowSample& sample, const TrainingParams& params, ProgressTracker* tracker, ConstructionStats* construction) {
+		nodes.clear();
+		children.clear();
+		histograms.clear();
+		if (construction) *construction = ConstructionStats();
+
+		num_values = source.numValues();
+		split_type = params.split_type;
+		TreeBuilder builder(*this, source.numAttributes(), params);
+
+		try {
+			builder.constructLevelWise(source, sample, params, tracker);
+		}
+		catch (const Cancelled&) {
+			nodes.clear();
+			children.clear();
+			histograms.clear();
+			return false;
+		}
+
+		// the arrays no longer grow, so drop their spare capacity
+		std::vector<DecisionTreeNode>(nodes).swap(nodes);
+		std::vector<int>(children).swap(children);
+		std::vector<unsigned char>(histograms).swap(histograms);
+
+		// the sample may be empty
+		if (nodes.size() == 0) return true;
+
+		setLabelFromChildren(0, params.priors);
+		if (construction) *construction = builder.construction;
+
+		return true;
+	}
+
+	/**
+	 * Return the index of the node where the traversal for the given attribute values stops:
+	 * either a leaf, or an internal node that has no child for the value.
+	 * If attribute_offsets is not NULL, the value of attribute a is read at data[attribute_offsets[a]]
+	 * instead of data[a], so that the attributes can be read in place, e.g. from an image.
+	 */
+	int DecisionTree::findNode(const unsigned char* data, const int* attribute_offsets) const {
+		if (nodes.size() == 0) throw "Tree is not constructed.";
+
+		int node_id = 0;
+		while (true) {
+			const DecisionTreeNode& node = nodes[node_id];
+
+			// if this is a leaf node, return the label
+			if (node.isLeaf()) return node_id;
+
+			// If the value does not exist in the children,
+			// we use maximum vote to guess the label.
+			unsigned char value = data[attribute_offsets ? attribute_offsets[node.split_attribute_id] : node.split_attribute_id];
+			int child = this->child(node_id, value);
+			if (child < 0) return node_id;
+
+			node_id = child;
+		}
+	}
+
+	/**
+	 * Return the widest vector instructions that both the CPU and the operating system support, in bits:
+	 * 512 for AVX-512, 256 for AVX2, or 0.
+	 */
+	static int vectorBits() {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7) return 0;
+
+		// the operating system must save the YMM registers (and the ZMM registers for AVX-512)
+		__cpuid(info, 1);
+		if (!(info[2] & (1 << 27))) return 0;
+		unsigned long long xcr0 = _xgetbv(0);
+		if ((xcr0 & 0x6) != 0x6) return 0;
+
+		__cpuidex(info, 7, 0);
+		if ((info[1] & (1 << 16)) && (xcr0 & 0xE6) == 0xE6) return 512;
+		if (info[1] & (1 << 5)) return 256;
+		return 0;
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+		if (__builtin_cpu_supports("avx512f")) return 512;
+		if (__builtin_cpu_supports("avx2")) return 256;
+		return 0;
+#else
+		return 0;
+#endif
+	}
+
+	/**
+	 * findNode for count examples whose rows start stride bytes apart. The examples advance
+	 * through the tree together, 16 per step with AVX-512 or 8 with AVX2, so the loads of one
+	 * level overlap instead of waiting on each other. The kernel is chosen at run time, see
+	 * TreeKernels.h, and the rest are traversed one at a time.
+	 * attribute_offsets is applied to every example as in findNode.
+	 */
+	void DecisionTree::findNodes(const unsigned char* data, int stride, int count, int* node_ids, const int* attribute_offsets) const {
+		if (nodes.size() == 0) throw "Tree is not constructed.";
+
+		static const int vector_bits = vectorBits();
+		int i = 0;
+		if (vector_bits >= 512) {
+			i = findNodesAVX512(nodes.data(), children.data(), num_values, thresholdSplits(), data, stride, count, attribute_offsets, node_ids);
+		}
+		if (vector_bits >= 256) {
+			// also takes the remainder of the AVX-512 kernel, or everything if it was built without AVX-512
+			i += findNodesAVX2(nodes.data(), children.data(), num_values, thresholdSplits(), data + (size_t)i * stride, stride, count - i, attribute_offsets, node_ids + i);
+		}
+		for (; i < count; ++i) {
+			node_ids[i] = findNode(data + (size_t)i * stride, attribute_offsets);
+		}
+	}
+
+	int DecisionTree::test(const unsigned char* data) const {
+		return nodes[findNode(data)].label;
+	}
+
+	int DecisionTree::test(const Example& example) const {
+		return test(example.data.data());
+	}
+
+	void DecisionTree::save(const QString& filename) {
+		QFile file(filename);
+		if (!file.open(QFile::WriteOnly)) throw "File cannot open.";
+
+		QDomDocument doc;
+
+		QDomElement root = save(doc);
+		doc.appendChild(root);
+
+		QTextStream out(&file);
+		doc.save(out, 4);
+	}
+
+	QDomElement DecisionTree::save(QDomDocument& doc) {
+		QDomElement tree_node = doc.createElement("tree");
+
+		if (nodes.size() > 0) {
+			QDomElement node = saveNode(doc, 0);
+			tree_node.appendChild(node);
+		}
+		
+		return tree_node;
+	}
+
+	TreeStats DecisionTree::stats() const {
+		TreeStats stats;
+		if (nodes.size() > 0) collectStats(0, 0, stats);
+
+		// the nodes, the histograms and the child slots as they are stored
+		stats.num_stored_nodes = nodes.size();
+		stats.bytes = bytes();
+		return stats;
+	}
+
+	/**
+	 * Merge structurally identical subtrees so that each is stored once, and return the number of
+	 * nodes removed. Two nodes are identical if they split on the same attribute and threshold, carry the same label
+	 * and histogram, and have identical children, so the traversal returns the same votes as before.
+	 * The example count and purity of a shared node are those of one of the merged subtrees.
+	 */
+	int DecisionTree::compact() {
+		if (nodes.size() == 0) return 0;
+
+		// Hash the subtrees bottom-up. A child has a larger index than its parent, so visiting the nodes
+		// backwards sees the children first. The representative of a subtree is its last copy, whose index
+		// is larger than the index of every parent of a copy, so the order of parents and children is kept.
+		std::vector<int> representative(nodes.size());
+		std::unordered_map<std::string, int> subtrees;
+		std::string key;
+		for (int node_id = (int)nodes.size() - 1; node_id >= 0; --node_id) {
+			const DecisionTreeNode& node = nodes[node_id];
+
+			key.assign((const char*)&node.split_attribute_id, sizeof(int));
+			key.push_back(node.label);
+			key.push_back(node.threshold);
+			if (hasHistograms()) key.append((const char*)histogram(node_id), Example::NUM_LABELS);
+			if (!node.isLeaf()) {
+				for (int slot = 0; slot < numSlots(); ++slot) {
+					int child = children[node.children_offset + slot];
+					if (child >= 0) child = representative[child];
+					key.append((const char*)&child, sizeof(int));
+				}
+			}
+
+			std::unordered_map<std::string, int>::iterator it = subtrees.find(key);
+			if (it == subtrees.end()) {
+				subtrees[key] = node_id;
+				representative[node_id] = node_id;
+			}
+			else {
+				representative[node_id] = it->second;
+			}
+		}
+
+		// keep the representatives in their original order
+		std::vector<int> new_ids(nodes.size(), -1);
+		int num_kept = 0;
+		for (int node_id = 0; node_id < nodes.size(); ++node_id) {
+			if (representative[node_id] == node_id) new_ids[node_id] = num_kept++;
+		}
+
+		std::vector<DecisionTreeNode> new_nodes;
+		std::vector<int> new_children;
+		std::vector<unsigned char> new_histograms;
+		new_nodes.reserve(num_kept);
+		if (hasHistograms()) new_histograms.reserve(num_kept * Example::NUM_LABELS);
+		for (int node_id = 0; node_id < nodes.size(); ++node_id) {
+			if (new_ids[node_id] < 0) continue;
+
+			DecisionTreeNode node = nodes[node_id];
+			if (!node.isLeaf()) {
+				int children_offset = new_children.size();
+				for (int slot = 0; slot < numSlots(); ++slot) {
+					int child = children[node.children_offset + slot];
+					new_children.push_back(child >= 0 ? new_ids[representative[child]] : -1);
+				}
+				node.children_offset = children_offset;
+			}
+			new_nodes.push_back(node);
+			if (hasHistograms()) new_histograms.insert(new_histograms.end(), histogram(node_id), histogram(node_id) + Example::NUM_LABELS);
+		}
+
+		int num_removed = nodes.size() - num_kept;
+		nodes.swap(new_nodes);
+		children.swap(new_children);
+		histograms.swap(new_histograms);
+		return num_removed;
+	}
+
+	/**
+	 * Mark the attributes that the internal nodes split on. used is resized to cover them if needed.
+	 */
+	void DecisionTree::markUsedAttributes(std::vector<bool>& used) const {
+		for (int node_id = 0; node_id < nodes.size(); ++node_id) {
+			const DecisionTreeNode& node = nodes[node_id];
+			if (node.isLeaf()) continue;
+
+			if (used.size() <= node.split_attribute_id) used.resize(node.split_attribute_id + 1, false);
+			used[node.split_attribute_id] = true;
+		}
+	}
+
+	/**
+	 * Add the number of times each node is visited when count examples, whose rows start stride bytes
+	 * apart, are traversed. visits is resized to the number of nodes if needed. attribute_offsets, if not NULL,
+	 * gives the offset of every attribute within a row, as for findNode.
+	 */
+	void DecisionTree::countVisits(const unsigned char* data, int stride, int count, std::vector<long long>& visits, const int* attribute_offsets) const {
+		if (nodes.size() == 0) throw "Tree is not constructed.";
+		visits.resize(nodes.size(), 0);
+
+		for (int i = 0; i < count; ++i) {
+			const unsigned char* row = data + (size_t)i * stride;
+
+			int node_id = 0;
+			while (true) {
+				visits[node_id]++;
+
+				const DecisionTreeNode& node = nodes[node_id];
+				if (node.isLeaf()) break;
+
+				int child = this->child(node_id, row[attribute_offsets ? attribute_offsets[node.split_attribute_id] : node.split_attribute_id]);
+				if (child < 0) break;
+
+				node_id = child;
+			}
+		}
+	}
+
+	/**
+	 * Lay out the nodes in groups of as many nodes as fit in a 64-byte cache line, according to the visit counts
+	 * from countVisits. A group starts at a node and takes its most visited descendants, so that a walk down the
+	 * hot paths touches about one group per group size levels, and the groups of the hottest subtrees follow
+	 * their parents. The vector does not align the groups to cache lines, so a group may straddle two of them.
+	 * The votes of the tree do not change.
+	 */
+	void DecisionTree::reorder(const std::vector<long long>& visits) {
+		if (nodes.size() == 0) return;
+		if (visits.size() != nodes.size()) throw "Visit counts do not match the tree.";
+
+		const int group_size = std::max(1, 64 / (int)sizeof(DecisionTreeNode));
+
+		// count the parents of the nodes reachable from the root, which come before their children
+		std::vector<bool> reachable(nodes.size(), false);
+		std::vector<int> num_parents(nodes.size(), 0);
+		reachable[0] = true;
+		for (int node_id = 0; node_id < nodes.size(); ++node_id) {
+			if (!reachable[node_id] || nodes[node_id].isLeaf()) continue;
+			for (int slot = 0; slot < numSlots(); ++slot) {
+				int child = children[nodes[node_id].children_offset + slot];
+				if (child < 0) continue;
+				reachable[child] = true;
+				num_parents[child]++;
+			}
+		}
+
+		// A node is placed once all of its parents are, so that every child still follows its parents when
+		// subtrees are shared. Every group grows by the most visited node on its frontier, and the rest of the
+		// frontier starts new groups, the hottest first.
+		std::vector<int> order;
+		order.reserve(nodes.size());
+		std::vector<int> group_roots(1, 0);
+		std::vector<int> frontier;
+		while (!group_roots.empty()) {
+			frontier.assign(1, group_roots.back());
+			group_roots.pop_back();
+			for (int size = 0; size < group_size && !frontier.empty(); ++size) {
+				int hottest = 0;
+				for (int i = 1; i < frontier.size(); ++i) {
+					if (visits[frontier[i]] > visits[frontier[hottest]]) hottest = i;
+				}
+				int node_id = frontier[hottest];
+				frontier.erase(frontier.begin() + hottest);
+				order.push_back(node_id);
+
+				if (nodes[node_id].isLeaf()) continue;
+				for (int slot = 0; slot < numSlots(); ++slot) {
+					int child = children[nodes[node_id].children_offset + slot];
+					if (child >= 0 && --num_parents[child] == 0) frontier.push_back(child);
+				}
+			}
+
+			std::stable_sort(frontier.begin(), frontier.end(), [&visits](int a, int b) { return visits[a] < visits[b]; });
+			group_roots.insert(group_roots.end(), frontier.begin(), frontier.end());
+		}
+
+		std::vector<int> new_ids(nodes.size(), -1);
+		for (int i = 0; i < order.size(); ++i) {
+			new_ids[order[i]] = i;
+		}
+
+		// rebuild the arrays, with the child slots in the order of their nodes
+		std::vector<DecisionTreeNode> new_nodes;
+		std::vector<int> new_children;
+		std::vector<unsigned char> new_histograms;
+		new_nodes.reserve(order.size());
+		new_children.reserve(children.size());
+		if (hasHistograms()) new_histograms.reserve(order.size() * Example::NUM_LABELS);
+		for (int i = 0; i < order.size(); ++i) {
+			DecisionTreeNode node = nodes[order[i]];
+			if (!node.isLeaf()) {
+				int children_offset = new_children.size();
+				for (int slot = 0; slot < numSlots(); ++slot) {
+					int child = children[node.children_offset + slot];
+					new_children.push_back(child >= 0 ? new_ids[child] : -1);
+				}
+				node.children_offset = children_offset;
+			}
+			new_nodes.push_back(node);
+			if (hasHistograms()) new_histograms.insert(new_histograms.end(), histogram(order[i]), histogram(order[i]) + Example::NUM_LABELS);
+		}
+
+		nodes.swap(new_nodes);
+		children.swap(new_children);
+		histograms.swap(new_histograms);
+	}
+
+	/**
+	 * Write the flat arrays of the tree: num_values, the split type and the sizes of the arrays as 32-bit integers,
+	 * followed by the nodes, the child slots and the histograms in the native byte order.
+	 */
+	void DecisionTree::saveBinary(std::ostream& out) const {
+		int header[5] = { num_values, split_type, (int)nodes.size(), (int)children.size(), (int)histograms.size() };
+		out.write((const char*)header, sizeof(header));
+
+		// the nodes are copied field by field into zeroed memory, so that the padding is written as zeros
+		// and the same tree always gives the same file
+		std::vector<DecisionTreeNode> packed(std::min(nodes.size(), (size_t)4096));
+		for (size_t begin = 0; begin < nodes.size(); begin += packed.size()) {
+			size_t count = std::min(packed.size(), nodes.size() - begin);
+			memset((void*)packed.data(), 0, count * sizeof(DecisionTreeNode));
+			for (size_t i = 0; i < count; ++i) {
+				const DecisionTreeNode& node = nodes[begin + i];
+				packed[i].split_attribute_id = node.split_attribute_id;
+				packed[i].children_offset = node.children_offset;
+				packed[i].label = node.label;
+				packed[i].threshold = node.threshold;
+				packed[i].num_examples = node.num_examples;
+				packed[i].purity = node.purity;
+			}
+			out.write((const char*)packed.data(), count * sizeof(DecisionTreeNode));
+		}
+
+		out.write((const char*)children.data(), children.size() * sizeof(int));
+		out.write((const char*)histograms.data(), histograms.size());
+	}
+
+	/**
+	 * Read a tree written by saveBinary. Version 1 files have no split type, and only multiway splits.
+	 * The split attributes must be below num_attributes, unless it is 0.
+	 */
+	void DecisionTree::loadBinary(std::istream& in, int version, int num_attributes) {
+		int header[5] = { 0, TrainingParams::SPLIT_MULTIWAY };
+		in.read((char*)header, sizeof(int));
+		if (version >= 2) in.read((char*)(header + 1), sizeof(int));
+		if (!in.read((char*)(header + 2), 3 * sizeof(int))) throw "Invalid model file.";
+		if (header[0] < 0 || header[0] > 256 || header[2] < 0 || header[3] < 0) throw "Invalid model file.";
+		if (header[1] != TrainingParams::SPLIT_MULTIWAY && header[1] != TrainingParams::SPLIT_THRESHOLD) throw "Invalid model file.";
+		if (header[4] != 0 && header[4] != (long long)header[2] * Example::NUM_LABELS) throw "Invalid model file.";
+
+		num_values = header[0];
+		split_type = header[1];
+		nodes.resize(header[2]);
+		children.resize(header[3]);
+		histograms.resize(header[4]);
+		in.read((char*)nodes.data(), nodes.size() * sizeof(DecisionTreeNode));
+		in.read((char*)children.data(), children.size() * sizeof(int));
+		in.read((char*)histograms.data(), histograms.size());
+		if (!in) throw "Invalid model file.";
+
+		// the traversal and the votes do not check the indices, so reject anything out of range
+		for (int node_id = 0; node_id < nodes.size(); ++node_id) {
+			const DecisionTreeNode& node = nodes[node_id];
+			if (node.label >= Example::NUM_LABELS) throw "Invalid model file.";
+			if (node.isLeaf()) {
+				if (node.children_offset != -1 || node.split_attribute_id != -1) throw "Invalid model file.";
+				continue;
+			}
+			if (node.split_attribute_id < 0 || (num_attributes > 0 && node.split_attribute_id >= num_attributes)) throw "Invalid model file.";
+			if (node.children_offset > (int)children.size() - numSlots()) throw "Invalid model file.";
+			if (thresholdSplits() && node.threshold >= num_values) throw "Invalid model file.";
+			for (int slot = 0; slot < numSlots(); ++slot) {
+				int child = children[node.children_offset + slot];
+				if (child >= (int)nodes.size() || (child >= 0 && child <= node_id)) throw "Invalid model file.";
+			}
+		}
+	}
+
+	// the most label counts the level-wise construction keeps for a pass, 64 MB
+	static const size_t LEVEL_HISTOGRAM_INTS = 1 << 24;
+
+	// the most trees built at a time from a BlockSource, each of which scans all the rows once per depth
+	static const int MAX_SCANNING_TREES = 2;
+
+	/**
+	 * Return n * log2(n), from a table for the counts that most nodes have.
+	 */
+	static float nLog2n(int n) {
+		static const int table_size = 1 << 16;
+		static const std::vector<float> table = []() {
+			std::vector<float> table(table_size, 0.0f);
+			for (int i = 1; i < table_size; ++i) {
+				table[i] = i * std::log2((double)i);
+			}
+			return table;
+		}();
+
+		return n < table_size ? table[n] : (float)(n * std::log2((double)n));
+	}
+
+	/**
+	 * Return the impurity of the label distribution given by the counts of every label, times the total count.
+	 * The weighted entropy is also n * log2(n) minus the sum of c * log2(c) over the label counts c, which
+	 * CRITERION_ENTROPY_TABLE computes without a logarithm.
+	 */
+	static float weightedImpurity(const int* labels, int total, int criterion) {
+		if (criterion == TrainingParams::CRITERION_GINI) {
+			double sum_squares = 0.0;
+			for (int label = 0; label < Example::NUM_LABELS; ++label) {
+				sum_squares += (double)labels[label] * labels[label];
+			}
+			return (float)(total - sum_squares / total);
+		}
+		else if (criterion == TrainingParams::CRITERION_ENTROPY_TABLE) {
+			float sum = 0.0f;
+			for (int label = 0; label < Example::NUM_LABELS; ++label) {
+				if (labels[label] > 1) sum += nLog2n(labels[label]);
+			}
+			return std::max(0.0f, nLog2n(total) - sum);
+		}
+
+		float entropy = 0.0f;
+		for (int label = 0; label < Example::NUM_LABELS; ++label) {
+			if (labels[label] == 0 || labels[label] == total) continue;
+
+			float p = (float)labels[label] / total;
+			entropy -= p * std::log2(p);
+		}
+		return entropy * total;
+	}
+
+	/**
+	 * Build the subtree for indices[0 .. num_examples - 1] depth-first, and return the index of its root node.
+	 * The indices are reordered so that the examples of each child are contiguous.
+	 */
+	int TreeBuilder::constructNodes(const Dataset& dataset, unsigned int* indices, unsigned int* weights, int num_examples, int depth, const TrainingParams& params, ProgressTracker* tracker) {
+		int split_attribute;
+		int threshold;
+		float gain;
+		int node_id = addNode(dataset, indices, weights, num_examples, depth, params, tracker, split_attribute, threshold, gain);
+		if (split_attribute < 0) return node_id;
+
+		int begin[256];
+		int count[256];
+		if (splitNode(dataset, indices, weights, num_examples, node_id, split_attribute, threshold, gain, params, begin, count) == 0) return node_id;
+
+		int children_offset = nodes[node_id].children_offset;
+		for (int slot = 0; slot < numSlots(); ++slot) {
+			if (count[slot] == 0) continue;
+
+			int child_id = constructNodes(dataset, indices + begin[slot], weights ? weights + begin[slot] : NULL, count[slot], depth + 1, params, tracker);
+			children[children_offset + slot] = child_id;
+		}
+
+		return node_id;
+	}
+
+	/**
+	 * A leaf that the best-first construction may split, with the split chosen for it.
+	 * The leaf's examples are indices[begin .. begin + num_examples - 1] of the construction.
+	 */
+	class Expansion {
+	public:
+		double priority;	// the impurity removed by the split, weighted by the number of examples
+		int node_id;
+		int begin;
+		int num_examples;
+		int depth;
+		int split_attribute;
+		int threshold;
+		float gain;
+
+	public:
+		bool operator<(const Expansion& other) const {
+			// among equal priorities, the older leaf first
+			if (priority != other.priority) return priority < other.priority;
+			return node_id > other.node_id;
+		}
+	};
+
+	/**
+	 * Build the tree for indices[0 .. num_examples - 1] best-first: always split the leaf whose split removes
+	 * the most impurity, weighted by its number of examples, until no leaf can be split within the limits.
+	 */
+	void TreeBuilder::constructBestFirst(const Dataset& dataset, unsigned int* indices, unsigned int* weights, int num_examples, const TrainingParams& params, ProgressTracker* tracker) {
+		std::priority_queue<Expansion> leaves;
+		Expansion root;
+		root.node_id = addNode(dataset, indices, weights, num_examples, 0, params, tracker, root.split_attribute, root.threshold, root.gain);
+		root.priority = (double)root.gain * nodes[root.node_id].num_examples;
+		root.begin = 0;
+		root.num_examples = num_examples;
+		root.depth = 0;
+		if (root.split_attribute >= 0) leaves.push(root);
+
+		while (!leaves.empty()) {
+			Expansion leaf = leaves.top();
+			leaves.pop();
+
+			unsigned int* leaf_indices = indices + leaf.begin;
+			unsigned int* leaf_weights = weights ? weights + leaf.begin : NULL;
+			int begin[256];
+			int count[256];
+			if (splitNode(dataset, leaf_indices, leaf_weights, leaf.num_examples, leaf.node_id, leaf.split_attribute, leaf.threshold, leaf.gain, params, begin, count) == 0) continue;
+
+			int children_offset = nodes[leaf.node_id].children_offset;
+			for (int slot = 0; slot < numSlots(); ++slot) {
+				if (count[slot] == 0) continue;
+
+				Expansion child;
+				child.node_id = addNode(dataset, leaf_indices + begin[slot], leaf_weights ? leaf_weights + begin[slot] : NULL, count[slot], leaf.depth + 1, params, tracker, child.split_attribute, child.threshold, child.gain);
+				children[children_offset + slot] = child.node_id;
+				if (child.split_attribute < 0) continue;
+
+				child.priority = (double)child.gain * nodes[child.node_id].num_examples;
+				child.begin = leaf.begin + begin[slot];
+				child.num_examples = count[slot];
+				child.depth = leaf.depth + 1;
+				leaves.push(child);
+			}
+		}
+	}
+
+	/**
+	 * Build the tree level by level, with one streaming pass over the rows of the source per depth. The pass for
+	 * a depth finds the node every row of the sample has reached, and adds the row to the label counts per value
+	 * of the attributes tried at that node. The counts of every node of the depth are then complete, and all of
+	 * them are split at once. The root is made from the counts of the first pass. If the counts of a depth would
+	 * not fit in LEVEL_HISTOGRAM_INTS, its nodes are counted in batches, with one pass per batch.
+	 *
+	 * If the source is in memory, every row keeps the node it has reached, and a pass moves it down by one
+	 * depth, so the passes take O(depth * rows). Otherwise nothing is kept per row, and every pass routes the
+	 * rows from the root again.
+	 */
+	void TreeBuilder::constructLevelWise(const BlockSource& source, const RowSample& sample, const TrainingParams& params, ProgressTracker* tracker) {
+		// the weights are drawn again on every pass
+		RowSample rows(sample);
+		std::vector<int> row_nodes;
+		if (source.inMemory()) row_nodes.assign(source.numRows(), 0);
+
+		int num_attributes = source.numAttributes();
+		int num_candidates = params.extra_trees ? params.num_random_splits : (params.sample_attributes ? (int)sqrt(num_attributes) : num_attributes);
+		size_t node_histogram_ints = (size_t)num_candidates * num_values * Example::NUM_LABELS;
+		int batch_size = std::max((size_t)1, LEVEL_HISTOGRAM_INTS / node_histogram_ints);
+
+		// the nodes of the current depth are [level_begin, level_end), and the open ones are to be split
+		int level_begin = 0;
+		int level_end = 1;
+		std::vector<int> open(1, 0);
+
+		std::vector<int> level_histograms;
+		for (int depth = 0; open.size() > 0; ++depth) {
+			std::vector<int> open_index(level_end - level_begin, -1);
+			for (int i = 0; i < open.size(); ++i) {
+				open_index[open[i] - level_begin] = i;
+			}
+
+			// the attributes tried at every open node
+			std::vector<int> candidates(open.size() * num_candidates);
+			std::vector<unsigned int> attributes(num_attributes);
+			for (int i = 0; i < open.size(); ++i) {
+				if (params.extra_trees) {
+					std::uniform_int_distribution<int> draw_attribute(0, num_attributes - 1);
+					for (int j = 0; j < num_candidates; ++j) {
+						candidates[i * num_candidates + j] = draw_attribute(rng);
+					}
+				}
+				else {
+					std::iota(attributes.begin(), attributes.end(), 0);
+					if (params.sample_attributes) std::shuffle(attributes.begin(), attributes.end(), rng);
+					std::copy(attributes.begin(), attributes.begin() + num_candidates, candidates.begin() + i * num_candidates);
+				}
+			}
+
+			std::vector<int> next_open;
+			for (int batch_begin = 0; batch_begin < open.size(); batch_begin += batch_size) {
+				int batch_end = std::min((int)open.size(), batch_begin + batch_size);
+				level_histograms.assign((batch_end - batch_begin) * node_histogram_ints, 0);
+
+				rows.restart();
+				source.scan([&](const DataBlock& block) {
+					// a pass over a file may take long, so a cancellation is not left until the next node
+					if (tracker) tracker->checkCancelled();
+
+					for (int r = 0; r < block.num_rows; ++r) {
+						unsigned int weight = rows.next();
+						if (weight == 0) continue;
+
+						// find the node of the row at the current depth, if it gets there
+						const unsigned char* values = block.data + (size_t)r * block.row_stride;
+						int node_id = row_nodes.size() > 0 ? row_nodes[block.first_row + r] : 0;
+						while (node_id >= 0 && node_id < level_begin) {
+							node_id = nodes[node_id].isLeaf() ? -1 : child(node_id, values[nodes[node_id].split_attribute_id * block.column_stride]);
+						}
+						if (row_nodes.size() > 0) row_nodes[block.first_row + r] = node_id;
+						if (node_id < 0) continue;
+
+						int i = open_index[node_id - level_begin];
+						if (i < batch_begin || i >= batch_end) continue;
+
+						int* histogram = &level_histograms[(i - batch_begin) * node_histogram_ints] + block.labels[r];
+						const int* attributes = &candidates[i * num_candidates];
+						for (int j = 0; j < num_candidates; ++j) {
+							histogram[(j * num_values + values[attributes[j] * block.column_stride]) * Example::NUM_LABELS] += weight;
+						}
+					}
+				});
+
+				for (int i = batch_begin; i < batch_end; ++i) {
+					int node_id = open[i];
+					const int (*node_histograms)[Example::NUM_LABELS] = (const int (*)[Example::NUM_LABELS])&level_histograms[(i - batch_begin) * node_histogram_ints];
+
+					// the label counts of the node are those of any attribute's values
+					int labels[Example::NUM_LABELS] = {};
+					for (int val = 0; val < num_values; ++val) {
+						for (int label = 0; label < Example::NUM_LABELS; ++label) {
+							labels[label] += node_histograms[val][label];
+						}
+					}
+					bool splittable;
+					if (depth == 0) {
+						if (std::accumulate(labels, labels + Example::NUM_LABELS, 0) == 0) return;
+						addLeaf(labels, 0, params, tracker, splittable);
+						if (!splittable) continue;
+					}
+					int total_weight = nodes[node_id].num_examples;
+
+					// score the split of every candidate attribute
+					float min_e = std::numeric_limits<float>::max();
+					int best_candidate = -1;
+					int best_threshold = 0;
+					for (int j = 0; j < num_candidates; ++j) {
+						const int (*histogram)[Example::NUM_LABELS] = node_histograms + j * num_values;
+						int count[256];
+						for (int val = 0; val < num_values; ++val) {
+							count[val] = 0;
+							for (int label = 0; label < Example::NUM_LABELS; ++label) {
+								count[val] += histogram[val][label];
+							}
+						}
+
+						int threshold = 0;
+						float e;
+						if (params.extra_trees) {
+							e = calculateRandomSplitImpurity(histogram, count, total_weight, params, threshold);
+						}
+						else if (split_type == TrainingParams::SPLIT_THRESHOLD) {
+							e = calculateThresholdImpurity(histogram, count, total_weight, params, threshold);
+						}
+						else {
+							e = calculateImpurity(histogram, count, total_weight, params);
+						}
+						if (e < min_e) {
+							min_e = e;
+							best_candidate = j;
+							best_threshold = threshold;
+						}
+					}
+
+					int split_attribute = best_candidate < 0 ? -1 : candidates[i * num_candidates + best_candidate];
+					float gain;
+					if (!acceptSplit(labels, total_weight, split_attribute, min_e, params, gain)) continue;
+
+					// the label counts of the children add up the counts of their values
+					const int (*histogram)[Example::NUM_LABELS] = node_histograms + best_candidate * num_values;
+					int slot_weights[256] = {};
+					int child_labels[256][Example::NUM_LABELS] = {};
+					for (int val = 0; val < num_values; ++val) {
+						int slot = split_type == TrainingParams::SPLIT_THRESHOLD ? val > best_threshold : val;
+						for (int label = 0; label < Example::NUM_LABELS; ++label) {
+							child_labels[slot][label] += histogram[val][label];
+							slot_weights[slot] += histogram[val][label];
+						}
+					}
+					if (addChildren(node_id, split_attribute, best_threshold, gain, slot_weights, params) == 0) continue;
+
+					int children_offset = nodes[node_id].children_offset;
+					for (int slot = 0; slot < numSlots(); ++slot) {
+						if (slot_weights[slot] == 0 || slot_weights[slot] < params.min_samples_leaf) continue;
+
+						int child_id = addLeaf(child_labels[slot], depth + 1, params, tracker, splittable);
+						children[children_offset + slot] = child_id;
+						if (splittable) next_open.push_back(child_id);
+					}
+				}
+			}
+
+			level_begin = level_end;
+			level_end = nodes.size();
+			open.swap(next_open);
+		}
+	}
+
+	/**
+	 * Add a leaf for indices[0 .. num_examples - 1], labelled by their majority, and return its index.
+	 * Unless the leaf should not be split, choose its split: the attribute, the threshold and the impurity
+	 * removed per example. split_attribute is -1 if the leaf is final.
+	 */
+	int TreeBuilder::addNode(const Dataset& dataset, const unsigned int* indices, const unsigned int* weights, int num_examples, int depth, const TrainingParams& params, ProgressTracker* tracker, int& split_attribute, int& threshold, float& gain) {
+		split_attribute = -1;
+		threshold = 0;
+		gain = 0.0f;
+
+		int labels[Example::NUM_LABELS] = {};
+		for (int i = 0; i < num_examples; ++i) {
+			labels[dataset.labels[indices[i]]] += weights ? weights[i] : 1;
+		}
+		bool splittable;
+		int node_id = addLeaf(labels, depth, params, tracker, splittable);
+		if (!splittable) return node_id;
+
+		int histogram[256][Example::NUM_LABELS];
+		int count[256];
+		float min_e = std::numeric_limits<float>::max();
+		int best_attribute = -1;
+		int best_threshold = 0;
+		if (params.extra_trees) {
+			// score a few random splits, and draw again for the attributes that are constant at this node
+			std::uniform_int_distribution<int> draw_attribute(0, dataset.num_attributes - 1);
+			int num_candidates = 0;
+			for (int i = 0; i < dataset.num_attributes && num_candidates < params.num_random_splits; ++i) {
+				int attribute = draw_attribute(rng);
+				int threshold = 0;
+				int total_weight = countLabels(dataset, indices, weights, num_examples, attribute, histogram, count);
+				float e = calculateRandomSplitImpurity(histogram, count, total_weight, params, threshold);
+				if (e == std::numeric_limits<float>::max()) continue;
+
+				num_candidates++;
+				if (e < min_e) {
+					min_e = e;
+					best_attribute = attribute;
+					best_threshold = threshold;
+				}
+			}
+		}
+		else {
+			// randomly sample the attributes
+			std::vector<unsigned int> attributes(dataset.num_attributes);
+			std::iota(attributes.begin(), attributes.end(), 0);
+			if (params.sample_attributes) {
+				std::shuffle(attributes.begin(), attributes.end(), rng);
+				attributes.resize(sqrt(attributes.size()));
+			}
+
+			// find the best attribute to split
+			for (int i = 0; i < attributes.size(); ++i) {
+				int threshold = 0;
+				int total_weight = countLabels(dataset, indices, weights, num_examples, attributes[i], histogram, count);
+				float e = split_type == TrainingParams::SPLIT_THRESHOLD ? calculateThresholdImpurity(histogram, count, total_weight, params, threshold) : calculateImpurity(histogram, count, total_weight, params);
+				if (e < min_e) {
+					min_e = e;
+					best_attribute = attributes[i];
+					best_threshold = threshold;
+				}
+			}
+		}
+
+		if (!acceptSplit(labels, nodes[node_id].num_examples, best_attribute, min_e, params, gain)) return node_id;
+
+		split_attribute = best_attribute;
+		threshold = best_threshold;
+		return node_id;
 	}
 
-	unsigned char DecisionTreeNode::test(const boost::shared_ptr<Example>& example) {
-		// if this is a leaf node, return the label
-		if (children.size() == 0) return label;
+	/**
+	 * Add a leaf for examples with the given label counts, labelled by their majority, and return its index.
+	 * splittable is false if the leaf is final because it is pure, at max_depth, smaller than min_samples_split,
+	 * or the tree has max_leaf_nodes leaves.
+	 */
+	int TreeBuilder::addLeaf(const int* labels, int depth, const TrainingParams& params, ProgressTracker* tracker, bool& splittable) {
+		splittable = false;
+
+		int node_id = nodes.size();
+		nodes.push_back(DecisionTreeNode());
 
-		if (children.contains(example->data[split_attribute_id])) {
-			return children[example->data[split_attribute_id]]->test(example);
+		// check if the labels are the same across the examples
+		int total_weight = 0;
+		for (int i = 0; i < Example::NUM_LABELS; ++i) {
+			total_weight += labels[i];
 		}
-		else {
-			// If the value does not exist in the children,
-			// we use maximum vote to guess the label.
-			return label;
+		nodes[node_id].num_examples = total_weight;
+
+		if (tracker) tracker->nodeBuilt(total_weight);
+
+		int num_labels = 0;
+		int max_votes = 0;
+		unsigned char max_voted_label = Example::LABEL_UNKNOWN;
+		for (int i = 0; i < Example::NUM_LABELS; ++i) {
+			if (labels[i] > 0) num_labels++;
+			if (labels[i] > max_votes) {
+				max_votes = labels[i];
+				max_voted_label = i;
+			}
+		}
+		nodes[node_id].label = max_voted_label;
+		nodes[node_id].purity = (float)max_votes / total_weight;
+
+		if (params.leaf_histograms) {
+			histograms.resize((node_id + 1) * Example::NUM_LABELS);
+			for (int i = 0; i < Example::NUM_LABELS; ++i) {
+				histograms[node_id * Example::NUM_LABELS + i] = ((long long)labels[i] * 255 + total_weight / 2) / total_weight;
+			}
 		}
+
+		if (num_labels == 1) {
+			// single label, and no need for futher splitting
+			construction.stops[TreeStats::STOP_PURE]++;
+			return node_id;
+		}
+
+		// check if the depth exceeds the max depth
+		if (depth >= params.max_depth) {
+			construction.stops[TreeStats::STOP_MAX_DEPTH]++;
+			return node_id;
+		}
+
+		if (total_weight < params.min_samples_split) {
+			construction.stops[TreeStats::STOP_MIN_SAMPLES_SPLIT]++;
+			return node_id;
+		}
+
+		// any split adds at least one leaf
+		if (params.max_leaf_nodes > 0 && num_leaves_built >= params.max_leaf_nodes) {
+			construction.stops[TreeStats::STOP_MAX_LEAF_NODES]++;
+			return node_id;
+		}
+
+		splittable = true;
+		return node_id;
 	}
 
-	QDomElement DecisionTreeNode::save(QDomDocument& doc) {
-		QDomElement node = doc.createElement("node");
+	/**
+	 * Return whether the best split found for a node with the given label counts is worth making, and set gain
+	 * to the impurity it removes per example. best_attribute is -1 and min_e the largest float if no split was found.
+	 */
+	bool TreeBuilder::acceptSplit(const int* labels, int total_weight, int best_attribute, float min_e, const TrainingParams& params, float& gain) {
+		// no threshold or random split of the sampled attributes separates any of the examples,
+		// or leaves min_samples_leaf examples on both sides
+		if (best_attribute < 0) {
+			construction.stops[params.min_samples_leaf > 1 && split_type == TrainingParams::SPLIT_THRESHOLD ? TreeStats::STOP_MIN_SAMPLES_LEAF : TreeStats::STOP_NO_SPLIT]++;
+			return false;
+		}
+
+		// the impurity removed by the split per example
+		gain = weightedImpurity(labels, total_weight, params.criterion) / total_weight - min_e;
+		if (params.min_gain > 0 && gain < params.min_gain) {
+			construction.stops[TreeStats::STOP_MIN_GAIN]++;
+			return false;
+		}
+
+		return true;
+	}
+
+	/**
+	 * Split the leaf node_id on split_attribute and threshold, and reorder indices[0 .. num_examples - 1] so that the
+	 * count[slot] examples of each child slot start at begin[slot]. The children with too few examples are not built,
+	 * and have a count of zero. Return the number of children to build, or zero if the node stays a leaf.
+	 */
+	int TreeBuilder::splitNode(const Dataset& dataset, unsigned int* indices, unsigned int* weights, int num_examples, int node_id, int split_attribute, int threshold, float gain, const TrainingParams& params, int* begin, int* count) {
+		// count the examples of every child slot of the attribute's value
+		unsigned char slots[256];
+		nodes[node_id].threshold = threshold;
+		for (int value = 0; value < num_values; ++value) {
+			slots[value] = slot(node_id, value);
+		}
+		int num_slots = numSlots();
+		int offsets[257] = {};
+		int slot_weights[256] = {};
+		for (int i = 0; i < num_examples; ++i) {
+			int slot = slots[dataset.row(indices[i])[split_attribute]];
+			offsets[slot + 1]++;
+			slot_weights[slot] += weights ? weights[i] : 1;
+		}
+
+		int num_children = addChildren(node_id, split_attribute, threshold, gain, slot_weights, params);
+		if (num_children == 0) return 0;
+
+		// split the examples by a stable counting sort on the child slot
+		for (int slot = 0; slot < num_slots; ++slot) {
+			offsets[slot + 1] += offsets[slot];
+		}
+		int position[256];
+		memcpy(position, offsets, sizeof(position[0]) * num_slots);
+		for (int i = 0; i < num_examples; ++i) {
+			int p = position[slots[dataset.row(indices[i])[split_attribute]]]++;
+			scratch[p] = indices[i];
+			if (weights) weight_scratch[p] = weights[i];
+		}
+		memcpy(indices, scratch.data(), sizeof(unsigned int) * num_examples);
+		if (weights) memcpy(weights, weight_scratch.data(), sizeof(unsigned int) * num_examples);
+
+		for (int slot = 0; slot < num_slots; ++slot) {
+			begin[slot] = offsets[slot];
+			count[slot] = slot_weights[slot] < params.min_samples_leaf ? 0 : offsets[slot + 1] - offsets[slot];
+		}
+
+		return num_children;
+	}
+
+	/**
+	 * Make the leaf node_id split on split_attribute and threshold, with empty child slots, given the weight of the
+	 * examples of every slot. The children with fewer than min_samples_leaf examples are not built. Return the
+	 * number of children to build, or zero if the node stays a leaf because no child is left, or because its
+	 * children would break max_leaf_nodes, max_nodes or max_bytes.
+	 */
+	int TreeBuilder::addChildren(int node_id, int split_attribute, int threshold, float gain, const int* slot_weights, const TrainingParams& params) {
+		// the children with too few examples are not built
+		int num_slots = numSlots();
+		int num_children = 0;
+		int num_small_children = 0;
+		for (int slot = 0; slot < num_slots; ++slot) {
+			if (slot_weights[slot] == 0) continue;
+
+			if (slot_weights[slot] < params.min_samples_leaf) {
+				num_small_children++;
+			}
+			else {
+				num_children++;
+			}
+		}
+		int reason = -1;
+		if (num_children == 0) {
+			reason = TreeStats::STOP_MIN_SAMPLES_LEAF;
+		}
+		else if (params.max_leaf_nodes > 0 && num_leaves_built + num_children - 1 > params.max_leaf_nodes) {
+			reason = TreeStats::STOP_MAX_LEAF_NODES;
+		}
+		else if (params.max_nodes > 0 && num_nodes_reserved + num_children > params.max_nodes) {
+			reason = TreeStats::STOP_BUDGET;
+		}
+		else if (params.max_bytes > 0 && (num_nodes_reserved + num_children) * (sizeof(DecisionTreeNode) + (params.leaf_histograms ? Example::NUM_LABELS : 0)) + (children.size() + num_slots) * sizeof(int) > params.max_bytes) {
+			reason = TreeStats::STOP_BUDGET;
+		}
+		if (reason >= 0) {
+			nodes[node_id].threshold = 0;
+			construction.stops[reason]++;
+			return 0;
+		}
+		construction.stops[TreeStats::STOP_MIN_SAMPLES_LEAF] += num_small_children;
+		num_leaves_built += num_children - 1;
+		num_nodes_reserved += num_children;
+
+		nodes[node_id].split_attribute_id = split_attribute;
+		nodes[node_id].threshold = threshold;
+		construction.importance.addSplit(split_attribute, (double)std::max(0.0f, gain) * nodes[node_id].num_examples);
 
-		if (children.size() == 0) {
-			node.setAttribute("label", label);
+		int children_offset = children.size();
+		nodes[node_id].children_offset = children_offset;
+		children.resize(children_offset + num_slots, -1);
+
+		return num_children;
+	}
+
+	/**
+	 * Count the weights of the examples per value of the split attribute and per label into histogram,
+	 * and per value into count, and return the total weight.
+	 */
+	int TreeBuilder::countLabels(const Dataset& dataset, const unsigned int* indices, const unsigned int* weights, int num_examples, int split_attribute, int histogram[][Example::NUM_LABELS], int* count) {
+		memset(histogram, 0, sizeof(histogram[0]) * num_values);
+		memset(count, 0, sizeof(count[0]) * num_values);
+		int total_weight = 0;
+		if (weights) {
+			for (int i = 0; i < num_examples; ++i) {
+				unsigned char val = dataset.row(indices[i])[split_attribute];
+				unsigned int weight = weights[i];
+				histogram[val][dataset.labels[indices[i]]] += weight;
+				count[val] += weight;
+				total_weight += weight;
+			}
 		}
 		else {
-			for (auto it = children.begin(); it != children.end(); ++it) {
-				QDomElement child_node = it.value()->save(doc);
-				child_node.setAttribute("value", it.key());
-				node.appendChild(child_node);
+			for (int i = 0; i < num_examples; ++i) {
+				unsigned char val = dataset.row(indices[i])[split_attribute];
+				histogram[val][dataset.labels[indices[i]]]++;
+				count[val]++;
 			}
+			total_weight = num_examples;
 		}
 
-		return node;
+		return total_weight;
+	}
+
+	/**
+	 * Return the impurity of the children of a split on an attribute, averaged over the examples, given the weights
+	 * of the examples per value and label in histogram, per value in count, and in total.
+	 */
+	float TreeBuilder::calculateImpurity(const int histogram[][Example::NUM_LABELS], const int* count, int total_weight, const TrainingParams& params) {
+		// calculate the impurity
+		float total_impurity = 0.0f;
+		for (int val = 0; val < num_values; ++val) {
+			if (count[val] == 0) continue;
+
+			total_impurity += weightedImpurity(histogram[val], count[val], params.criterion);
+		}
+
+		return total_impurity / total_weight;
+	}
+
+	/**
+	 * Return the smallest impurity of a split into value <= threshold and value > threshold, and set threshold.
+	 * The label counts of both sides are running sums over the per-value counts of histogram, so all the
+	 * thresholds cost one pass over the examples. Return the largest float if no threshold leaves min_samples_leaf examples
+	 * on both sides.
+	 */
+	float TreeBuilder::calculateThresholdImpurity(const int histogram[][Example::NUM_LABELS], const int* count, int total_weight, const TrainingParams& params, int& threshold) {
+		int total[Example::NUM_LABELS] = {};
+		for (int val = 0; val < num_values; ++val) {
+			for (int label = 0; label < Example::NUM_LABELS; ++label) {
+				total[label] += histogram[val][label];
+			}
+		}
+
+		float min_e = std::numeric_limits<float>::max();
+		int left[Example::NUM_LABELS] = {};
+		int right[Example::NUM_LABELS];
+		int num_left = 0;
+		for (int t = 0; t + 1 < num_values; ++t) {
+			for (int label = 0; label < Example::NUM_LABELS; ++label) {
+				left[label] += histogram[t][label];
+			}
+			num_left += count[t];
+
+			// a threshold between the same two values as the previous one splits the same way
+			if (count[t] == 0 || num_left == total_weight) continue;
+
+			int num_right = total_weight - num_left;
+			if (num_left < params.min_samples_leaf || num_right < params.min_samples_leaf) continue;
+
+			for (int label = 0; label < Example::NUM_LABELS; ++label) {
+				right[label] = total[label] - left[label];
+			}
+			float e = (weightedImpurity(left, num_left, params.criterion) + weightedImpurity(right, num_right, params.criterion)) / total_weight;
+			if (e < min_e) {
+				min_e = e;
+				threshold = t;
+			}
+		}
+
+		return min_e;
 	}
 
-	unsigned char DecisionTreeNode::setLabelFromChildren(const QMap<unsigned char, float>& priors) {
-		if (children.size() > 0) {
-			QMap<unsigned char, float> votes;
-			for (auto it = children.begin(); it != children.end(); ++it) {
-				unsigned char label = it.value()->setLabelFromChildren(priors);
-				if (!votes.contains(label)) {
-					votes[label] = 0;
+	/**
+	 * Return the impurity of a random split given the counts of histogram, or the largest float if the attribute has the same
+	 * value at all the examples. A threshold split draws its threshold uniformly between the smallest and the
+	 * largest value of the examples, and sets threshold. It is rejected the same way if it leaves fewer than
+	 * min_samples_leaf examples on either side. A multiway split has nothing to draw.
+	 */
+	float TreeBuilder::calculateRandomSplitImpurity(const int histogram[][Example::NUM_LABELS], const int* count, int total_weight, const TrainingParams& params, int& threshold) {
+		int min_value = 0;
+		while (count[min_value] == 0) min_value++;
+		int max_value = num_values - 1;
+		while (count[max_value] == 0) max_value--;
+		if (min_value == max_value) return std::numeric_limits<float>::max();
+
+		float total_impurity = 0.0f;
+		if (split_type == TrainingParams::SPLIT_THRESHOLD) {
+			threshold = std::uniform_int_distribution<int>(min_value, max_value - 1)(rng);
+
+			int left[Example::NUM_LABELS] = {};
+			int right[Example::NUM_LABELS] = {};
+			int num_left = 0;
+			for (int val = min_value; val <= max_value; ++val) {
+				int* side = val <= threshold ? left : right;
+				for (int label = 0; label < Example::NUM_LABELS; ++label) {
+					side[label] += histogram[val][label];
 				}
+				if (val <= threshold) num_left += count[val];
+			}
+			int num_right = total_weight - num_left;
+			if (num_left < params.min_samples_leaf || num_right < params.min_samples_leaf) return std::numeric_limits<float>::max();
+
+			total_impurity = weightedImpurity(left, num_left, params.criterion) + weightedImpurity(right, num_right, params.criterion);
+		}
+		else {
+			for (int val = min_value; val <= max_value; ++val) {
+				if (count[val] == 0) continue;
+
+				total_impurity += weightedImpurity(histogram[val], count[val], params.criterion);
+			}
+		}
+
+		return total_impurity / total_weight;
+	}
+
+	unsigned char DecisionTree::setLabelFromChildren(int node_id, const std::vector<float>& priors) {
+		if (!nodes[node_id].isLeaf()) {
+			float votes[Example::NUM_LABELS] = {};
+			for (int slot = 0; slot < numSlots(); ++slot) {
+				int child = children[nodes[node_id].children_offset + slot];
+				if (child < 0) continue;
+
+				unsigned char label = setLabelFromChildren(child, priors);
 				if (priors.size() == 0) {
 					votes[label]++;
 				}
@@ -61,205 +1938,374 @@ namespace rf {
 				}
 			}
 
-			int max_votes = 0;
-			unsigned char max_voted_label;
-			for (auto it = votes.begin(); it != votes.end(); ++it) {
-				if (it.value() > max_votes) {
-					max_votes = it.value();
-					max_voted_label = it.key();
+			float max_votes = 0;
+			unsigned char max_voted_label = Example::LABEL_UNKNOWN;
+			for (int i = 0; i < Example::NUM_LABELS; ++i) {
+				if (votes[i] > max_votes) {
+					max_votes = votes[i];
+					max_voted_label = i;
 				}
 			}
 
-			label = max_voted_label;
+			nodes[node_id].label = max_voted_label;
 		}
 
-		return label;
+		return nodes[node_id].label;
 	}
 
-	DecisionTree::DecisionTree() {
-	}
+	QDomElement DecisionTree::saveNode(QDomDocument& doc, int node_id) {
+		QDomElement node = doc.createElement("node");
+
+		if (hasHistograms()) {
+			QString counts;
+			for (int i = 0; i < Example::NUM_LABELS; ++i) {
+				if (i > 0) counts += ",";
+				counts += QString::number(histogram(node_id)[i]);
+			}
+			node.setAttribute("histogram", counts);
+		}
 
-	void DecisionTree::construct(const std::vector<boost::shared_ptr<Example>>& examples, bool sample_attributes, int max_depth, const QMap<unsigned char, float>& priors) {
-		if (examples.size() == 0) return;
+		if (nodes[node_id].isLeaf()) {
+			node.setAttribute("label", nodes[node_id].label);
+		}
+		else if (thresholdSplits()) {
+			node.setAttribute("threshold", nodes[node_id].threshold);
+			for (int slot = 0; slot < 2; ++slot) {
+				int child = children[nodes[node_id].children_offset + slot];
+				if (child < 0) continue;
+
+				QDomElement child_node = saveNode(doc, child);
+				child_node.setAttribute("branch", slot == 0 ? "le" : "gt");
+				node.appendChild(child_node);
+			}
+		}
+		else {
+			for (int value = 0; value < num_values; ++value) {
+				int child = children[nodes[node_id].children_offset + value];
+				if (child < 0) continue;
 
-		root = constructNodes(examples, 0, sample_attributes, max_depth);
+				QDomElement child_node = saveNode(doc, child);
+				child_node.setAttribute("value", value);
+				node.appendChild(child_node);
+			}
+		}
 
-		root->setLabelFromChildren(priors);
+		return node;
 	}
 
-	int DecisionTree::test(const boost::shared_ptr<Example>& example) {
-		if (!root) throw "Tree is not constructed.";
+	void DecisionTree::collectStats(int node_id, int depth, TreeStats& stats) const {
+		const DecisionTreeNode& node = nodes[node_id];
+
+		if (node.isLeaf()) {
+			stats.addNode(depth, 0);
+			stats.addLeaf(depth, node.num_examples, node.purity);
+		}
+		else {
+			int num_children = 0;
+			for (int slot = 0; slot < numSlots(); ++slot) {
+				if (children[node.children_offset + slot] >= 0) num_children++;
+			}
+			stats.addNode(depth, num_children);
 
-		return root->test(example);
+			for (int slot = 0; slot < numSlots(); ++slot) {
+				int child = children[node.children_offset + slot];
+				if (child >= 0) collectStats(child, depth + 1, stats);
+			}
+		}
+	}
+	
+	RandomForest::RandomForest() {
+		num_attributes = 0;
+		criterion = TrainingParams::CRITERION_ENTROPY;
 	}
 
-	void DecisionTree::save(const QString& filename) {
-		QFile file(filename);
-		if (!file.open(QFile::WriteOnly)) throw "File cannot open.";
+	/**
+	 * Build the forest. With params.num_threads above one, that many trees are built at a time,
+	 * all reading the same dataset. With params.estimate_oob, the examples each tree did not draw are
+	 * labelled as soon as the tree is built, see oob(). Return false if the monitor cancelled the construction,
+	 * in which case the forest is left empty.
+	 */
+	bool RandomForest::construct(const Dataset& dataset, const TrainingParams& params, ProgressMonitor* monitor) {
+		this->num_attributes = dataset.num_attributes;
+		this->priors = params.priors;
+		this->criterion = params.criterion;
+		oob_estimate = OOBEstimate();
 
-		QDomDocument doc;
+		ProgressTracker tracker(monitor, params.num_trees, (long long)(dataset.totalWeight() * params.ratio) * params.max_depth);
+		std::unique_ptr<OOBAccumulator> oob(params.estimate_oob ? new OOBAccumulator(dataset, params) : NULL);
 
-		QDomElement root = save(doc);
-		doc.appendChild(root);
+		if (!constructTrees(params, [&](int tree_id) { return constructTree(dataset, params, tree_id, monitor ? &tracker : NULL, oob.get()); })) return false;
 
-		QTextStream out(&file);
-		doc.save(out, 4);
+		if (oob) oob_estimate = oob->estimate;
+
+		return true;
 	}
 
-	QDomElement DecisionTree::save(QDomDocument& doc) {
-		QDomElement tree_node = doc.createElement("tree");
+	/**
+	 * Construct the forest level-wise from rows that are read block by block, such as a ChunkedDataset larger than
+	 * memory, whatever params.growth is. Each tree keeps nothing per row: it draws its sample again and reads the
+	 * rows once per depth, see TreeBuilder::constructLevelWise. The rows are unweighted, and the out-of-bag error is not available.
+	 * At most MAX_SCANNING_TREES trees are built at a time, whatever params.num_threads is, since every tree reads all the
+	 * rows per depth and more of them would only compete for the disk.
+	 */
+	bool RandomForest::construct(const BlockSource& source, const TrainingParams& params, ProgressMonitor* monitor) {
+		if (params.estimate_oob) throw "The out-of-bag error needs the dataset in memory.";
 
-		if (root) {
-			QDomElement node = root->save(doc);
-			tree_node.appendChild(node);
-		}
-		
-		return tree_node;
+		this->num_attributes = source.numAttributes();
+		this->priors = params.priors;
+		this->criterion = params.criterion;
+		oob_estimate = OOBEstimate();
+
+		ProgressTracker tracker(monitor, params.num_trees, (long long)(source.numRows() * params.ratio) * params.max_depth);
+
+		TrainingParams forest_params(params);
+		forest_params.num_threads = std::min(params.num_threads, MAX_SCANNING_TREES);
+
+		return constructTrees(forest_params, [&](int tree_id) { return constructTree(source, params, tree_id, monitor ? &tracker : NULL); });
 	}
 
-	boost::shared_ptr<DecisionTreeNode> DecisionTree::constructNodes(const std::vector<boost::shared_ptr<Example>>& examples, int depth, bool sample_attributes, int max_depth) {
-		boost::shared_ptr<DecisionTreeNode> node = boost::shared_ptr<DecisionTreeNode>(new DecisionTreeNode(depth));
+	/**
+	 * Build every tree with construct_tree(tree_id), params.num_threads trees at a time, and merge their importance.
+	 * Return false, leaving the forest empty, if the construction of a tree was cancelled.
+	 */
+	bool RandomForest::constructTrees(const TrainingParams& params, const std::function<bool(int tree_id)>& construct_tree) {
+		trees.clear();
+		trees.resize(params.num_trees);
+		construction.assign(params.num_trees, ConstructionStats());
+		feature_importance = FeatureImportance();
 
-		// check if the labels are the same across the examples
-		QMap<unsigned char, int> labels;
-		for (int i = 0; i < examples.size(); ++i) {
-			if (!labels.contains(examples[i]->label)) {
-				labels[examples[i]->label] = 0;
-			}
-			labels[examples[i]->label]++;
-		}
-		if (labels.size() == 1) {
-			// single label, and no need for futher splitting
-			node->label = labels.begin().key();
-			return node;
-		}
+		int num_threads = std::max(1, std::min(params.num_threads, params.num_trees));
+		if (num_threads == 1) {
+			for (int i = 0; i < params.num_trees; ++i) {
+				MemoryPhase phase("tree " + std::to_string(i + 1));
 
-		// check if the depth exceeds the max depth
-		if (depth >= max_depth) {
-			unsigned char max_voted_label = Example::LABEL_UNKNOWN;
-			int max_votes = 0;
-			for (auto it = labels.begin(); it != labels.end(); ++it) {
-				if (it.value() > max_votes) {
-					max_votes = it.value();
-					max_voted_label = it.key();
+				if (!construct_tree(i)) {
+					trees.clear();
+					construction.clear();
+					return false;
 				}
 			}
-
-			node->label = max_voted_label;
-			return node;
-		}
-
-		// randomly sample the attributes
-		std::vector<unsigned int> indices;
-		if (sample_attributes) {
-			indices = std::vector<unsigned int>(examples[0]->data.size());
-			std::iota(indices.begin(), indices.end(), 0);
-			std::random_shuffle(indices.begin(), indices.end());
-			indices.resize(sqrt(indices.size()));
 		}
 		else {
-			indices = std::vector<unsigned int>(examples[0]->data.size());
-			std::iota(std::begin(indices), std::end(indices), 0);
-		}
+			MemoryPhase phase("trees");
 
-		// find the best attribute to split
-		float min_e = std::numeric_limits<float>::max();
-		int best_attribute = -1;
-		for (int i = 0; i < indices.size(); ++i) {
-			float e = calculateEntropy(examples, indices[i]);
-			if (e < min_e) {
-				min_e = e;
-				best_attribute = indices[i];
+			// every thread takes the next tree to build until none is left. An error, such as a failed read,
+			// stops the other threads and is thrown again on the calling thread once they have all finished.
+			std::atomic<int> next_tree(0);
+			std::atomic<bool> cancelled(false);
+			std::vector<std::exception_ptr> errors(num_threads);
+			std::vector<std::thread> threads;
+			for (int t = 0; t < num_threads; ++t) {
+				threads.push_back(std::thread([&, t]() {
+					try {
+						for (int i = next_tree++; i < params.num_trees && !cancelled; i = next_tree++) {
+							// the other threads allocate at the same time, so every tree counts its own thread's allocations
+							MemoryPhase tree_phase("tree " + std::to_string(i + 1), true);
+
+							if (!construct_tree(i)) cancelled = true;
+						}
+					}
+					catch (...) {
+						errors[t] = std::current_exception();
+						cancelled = true;
+					}
+				}));
+			}
+			for (int t = 0; t < num_threads; ++t) {
+				threads[t].join();
 			}
-		}
-		node->split_attribute_id = best_attribute;
 
-		// split the examples
-		QMap<unsigned char, std::vector<boost::shared_ptr<Example>>> subsets;
-		for (int i = 0; i < examples.size(); ++i) {
-			unsigned char val = examples[i]->data[best_attribute];
-			if (!subsets.contains(val)) {
-				subsets[val] = std::vector<boost::shared_ptr<Example>>();
+			for (int t = 0; t < num_threads; ++t) {
+				if (errors[t]) {
+					trees.clear();
+					construction.clear();
+					std::rethrow_exception(errors[t]);
+				}
+			}
+			if (cancelled) {
+				trees.clear();
+				construction.clear();
+				return false;
 			}
-			subsets[val].push_back(examples[i]);
 		}
 
-		for (auto it = subsets.begin(); it != subsets.end(); ++it) {
-			boost::shared_ptr<DecisionTreeNode> child_node = constructNodes(it.value(), depth + 1, sample_attributes, max_depth);
-			node->children[it.key()] = child_node;
+		// every tree records its own splits while it is built, so the threads never share them
+		for (int i = 0; i < construction.size(); ++i) {
+			feature_importance.merge(construction[i].importance);
 		}
 
-		return node;
+		return true;
 	}
 
-	float DecisionTree::calculateEntropy(const std::vector<boost::shared_ptr<Example>>& examples, int split_attribute) {
-		// split the examples
-		QMap<unsigned char, QMap<unsigned char, int>> histogram;
-		QMap<unsigned char, int> count;
-		for (int i = 0; i < examples.size(); ++i) {
-			unsigned char val = examples[i]->data[split_attribute];
-			unsigned char label = examples[i]->label;
-			if (!histogram.contains(val)) {
-				histogram[val] = QMap<unsigned char, int>();
-				count[val] = 0;
-			}
-			if (!histogram[val].contains(label)) {
-				histogram[val][label] = 0;
+	/**
+	 * Draw the sample of the tree_id-th tree from num_rows rows of the given weights, or of weight one if
+	 * row_weights is empty. Every draw is a function of params.seed, tree_id and the row, so the forest does
+	 * not depend on the order or the thread the trees are built in. Only the rows drawn at least once are
+	 * listed in indices, in ascending order, and weights is empty if every drawn row counts once.
+	 *
+	 * Without poisson_bagging, a fraction ratio of the rows is selected without replacement in a single pass
+	 * (selection sampling). For a weighted dataset, each of the identical examples of a row is drawn with
+	 * probability ratio instead. With poisson_bagging, every example is drawn Poisson(ratio) times, so a row
+	 * of weight w gets the weight Poisson(ratio * w).
+	 */
+	static void drawSample(const TrainingParams& params, int tree_id, size_t num_rows, const std::vector<unsigned int>& row_weights, std::vector<unsigned int>& indices, std::vector<unsigned int>& weights) {
+		unsigned long long key = mixBits(((unsigned long long)params.seed << 32) + tree_id);
+
+		indices.clear();
+		weights.clear();
+		if (row_weights.size() == 0) {
+			RowSample sample(params, tree_id, num_rows);
+			for (unsigned int row = 0; row < num_rows; ++row) {
+				unsigned int count = sample.next();
+				if (count == 0) continue;
+
+				indices.push_back(row);
+				if (params.poisson_bagging) weights.push_back(count);
 			}
-			histogram[val][label]++;
-			count[val]++;
 		}
+		else if (params.poisson_bagging) {
+			for (unsigned int row = 0; row < num_rows; ++row) {
+				unsigned int count = drawPoisson(params.ratio * row_weights[row], counterUniform(key, row, 0), counterUniform(key, row, 1));
+				if (count == 0) continue;
 
-		// calculate the entropy
-		float total_entropy = 0.0f;
-		for (auto it = histogram.begin(); it != histogram.end(); ++it) {
-			float entropy = 0.0f;
-			if (it.value().size() <= 1) {
-				entropy = 0.0f;
+				indices.push_back(row);
+				weights.push_back(count);
 			}
-			else {
-				for (auto it2 = it.value().begin(); it2 != it.value().end(); ++it2) {
-					float p = (float)(it2.value()) / count[it.key()];
-					entropy -= p * std::log2(p);
-				}
+		}
+		else {
+			for (unsigned int row = 0; row < num_rows; ++row) {
+				unsigned int count = drawBinomial(row_weights[row], params.ratio, counterUniform(key, row, 0), counterUniform(key, row, 1));
+				if (count == 0) continue;
+
+				indices.push_back(row);
+				weights.push_back(count);
 			}
-			total_entropy += entropy * count[it.key()];
 		}
+	}
 
-		return total_entropy / examples.size();
+	/**
+	 * Return the parameters of the tree_id-th tree, whose attributes are drawn from their own generator.
+	 */
+	static TrainingParams treeParams(const TrainingParams& params, int tree_id) {
+		TrainingParams tree_params = params;
+		tree_params.seed = mixBits(mixBits(((unsigned long long)params.seed << 32) + tree_id)) & 0xffffffff;
+		return tree_params;
 	}
-	
-	RandomForest::RandomForest() {
+
+	/**
+	 * Report a built tree to the tracker, with the work of its construction: the examples of all its nodes.
+	 */
+	static void reportTree(const DecisionTree& tree, ProgressTracker* tracker) {
+		long long tree_work = 0;
+		for (int node_id = 0; node_id < tree.numNodes(); ++node_id) {
+			tree_work += tree.node(node_id).num_examples;
+		}
+		tracker->treeBuilt(tree_work);
 	}
 
-	void RandomForest::construct(const std::vector<boost::shared_ptr<Example>>& examples, int num_trees, float ratio, int max_depth, const QMap<unsigned char, float>& priors) {
-		this->priors = priors;
+	/**
+	 * Draw the sample of the tree_id-th tree, see drawSample, and build the tree.
+	 * If oob is not NULL, the tree then labels the examples it did not draw.
+	 */
+	bool RandomForest::constructTree(const Dataset& dataset, const TrainingParams& params, int tree_id, ProgressTracker* tracker, OOBAccumulator* oob) {
+		std::vector<unsigned int> indices;
+		std::vector<unsigned int> weights;
+		drawSample(params, tree_id, dataset.size(), dataset.weights, indices, weights);
+
+		if (!trees[tree_id].construct(dataset, indices, treeParams(params, tree_id), tracker, weights.size() > 0 ? weights.data() : NULL, &construction[tree_id])) return false;
 
-		trees.clear();
+		// the votes are merged before the progress report, which then carries the latest error
+		if (oob) addOOBVotes(dataset, params, tree_id, indices, weights, *oob, tracker);
+
+		if (tracker) reportTree(trees[tree_id], tracker);
+
+		return true;
+	}
+
+	/**
+	 * Build the tree_id-th tree level-wise from the rows of the source, drawing its sample as it reads them.
+	 */
+	bool RandomForest::constructTree(const BlockSource& source, const TrainingParams& params, int tree_id, ProgressTracker* tracker) {
+		if (!trees[tree_id].construct(source, RowSample(params, tree_id, source.numRows()), treeParams(params, tree_id), tracker, &construction[tree_id])) return false;
+
+		if (tracker) reportTree(trees[tree_id], tracker);
+
+		return true;
+	}
+
+	/**
+	 * Label the examples that the tree_id-th tree did not draw, given the rows it drew in ascending order
+	 * and their weights, and merge the votes of all the trees up to the first one not built yet.
+	 * A row of w identical examples drawn c times has (w - c) / w of its examples left out. With poisson_bagging,
+	 * the c draws fall on any of the w examples alike, so each is left out with probability ((w - 1) / w)^c.
+	 */
+	void RandomForest::addOOBVotes(const Dataset& dataset, const TrainingParams& params, int tree_id, const std::vector<unsigned int>& indices, const std::vector<unsigned int>& weights, OOBAccumulator& oob, ProgressTracker* tracker) {
+		std::vector<OOBVote> tree_votes;
+		size_t next_drawn = 0;
+		for (unsigned int row = 0; row < dataset.size(); ++row) {
+			unsigned int count = 0;
+			if (next_drawn < indices.size() && indices[next_drawn] == row) {
+				count = weights.size() > 0 ? weights[next_drawn] : 1;
+				next_drawn++;
+			}
+
+			float fraction = 1.0f;
+			if (count > 0) {
+				double w = dataset.weight(row);
+				fraction = params.poisson_bagging ? pow((w - 1) / w, count) : std::max(0.0, (w - count) / w);
+			}
+			if (fraction == 0) continue;
+
+			OOBVote vote;
+			vote.row = row;
+			vote.node_id = trees[tree_id].findNode(dataset.row(row));
+			vote.fraction = fraction;
+			tree_votes.push_back(vote);
+		}
+
+		std::lock_guard<std::mutex> lock(oob.mutex);
+		oob.pending[tree_id].swap(tree_votes);
+		while (oob.pending.size() > 0 && oob.pending.begin()->first == oob.num_merged) {
+			const DecisionTree& tree = trees[oob.num_merged];
+			const std::vector<OOBVote>& votes = oob.pending.begin()->second;
+			for (int i = 0; i < votes.size(); ++i) {
+				size_t row = votes[i].row;
+				unsigned char label;
+				if (oob.counts.size() > 0) {
+					unsigned short* row_counts = &oob.counts[row * Example::NUM_LABELS];
+					row_counts[tree.nodeLabel(votes[i].node_id)]++;
+					label = votedLabel(row_counts);
+				}
+				else {
+					float tree_votes[Example::NUM_LABELS] = {};
+					addVotes(tree, votes[i].node_id, tree_votes);
 
-		for (int i = 0; i < num_trees; ++i) {
-			printf("Tree: %d\n", i + 1);
+					float* row_votes = &oob.votes[row * Example::NUM_LABELS];
+					for (int label = 0; label < Example::NUM_LABELS; ++label) {
+						row_votes[label] += tree_votes[label] * votes[i].fraction;
+					}
+					label = votedLabel(row_votes);
+				}
 
-			// randomly sample the examples
-			std::vector<unsigned int> indices(examples.size());
-			std::iota(indices.begin(), indices.end(), 0);
-			std::random_shuffle(indices.begin(), indices.end());
-			indices.resize(examples.size() * ratio);
+				// only the rows whose label changes move in the confusion matrix
+				if (label == oob.labels[row]) continue;
 
-			std::vector<boost::shared_ptr<Example>> subset(indices.size());
-			for (int j = 0; j < subset.size(); ++j) {
-				subset[j] = examples[indices[j]];
+				double* truth = &oob.estimate.confusion[dataset.labels[row] * Example::NUM_LABELS];
+				if (oob.labels[row] < Example::NUM_LABELS) truth[oob.labels[row]] -= dataset.weight(row);
+				truth[label] += dataset.weight(row);
+				oob.labels[row] = label;
 			}
-			
-			// construct a decision tree
-			DecisionTree dt;
-			dt.construct(subset, true, max_depth, priors);
+			oob.pending.erase(oob.pending.begin());
+			oob.num_merged++;
 
-			trees.push_back(dt);
+			oob.estimate.error_curve.push_back(oob.estimate.error());
+			if (tracker) tracker->oobEstimated(oob.estimate.error());
 		}
 	}
 
 	void RandomForest::save(const QString& filename) {
+		MemoryPhase phase("save");
+
 		QFile file(filename);
 		if (!file.open(QFile::WriteOnly)) throw "File cannot open.";
 
@@ -267,6 +2313,7 @@ namespace rf {
 
 		// set root node
 		QDomElement root = doc.createElement("random_forest");
+		root.setAttribute("criterion", QString::fromStdString(TrainingParams::criterionName(criterion)));
 		doc.appendChild(root);
 
 		// write trees
@@ -280,30 +2327,195 @@ namespace rf {
 		doc.save(out, 4);
 	}
 
-	int RandomForest::test(const boost::shared_ptr<Example>& example) {
+	/**
+	 * Save the forest in the flat binary format: the magic "RFB4", the number of trees, the number of priors,
+	 * the criterion and the number of attributes as 32-bit integers, the priors, and then every tree as written by
+	 * DecisionTree::saveBinary. "RFB1" files, written before trees had a split type, "RFB2" files, without the
+	 * criterion, and "RFB3" files, without the number of attributes, can still be loaded.
+	 */
+	void RandomForest::saveBinary(const std::string& filename) const {
+		MemoryPhase phase("save");
+
+		std::ofstream out(filename.c_str(), std::ios::binary);
+		if (!out) throw "File cannot open.";
+
+		int header[4] = { (int)trees.size(), (int)priors.size(), criterion, num_attributes };
+		out.write("RFB4", 4);
+		out.write((const char*)header, sizeof(header));
+		out.write((const char*)priors.data(), priors.size() * sizeof(float));
+		for (int i = 0; i < trees.size(); ++i) {
+			trees[i].saveBinary(out);
+		}
+		if (!out) throw "File cannot be written.";
+	}
+
+	void RandomForest::loadBinary(const std::string& filename) {
+		std::ifstream in(filename.c_str(), std::ios::binary);
+		if (!in) throw "File cannot open.";
+
+		char magic[4];
+		int header[4] = { 0, 0, TrainingParams::CRITERION_ENTROPY, 0 };
+		if (!in.read(magic, 4) || memcmp(magic, "RFB", 3) != 0 || magic[3] < '1' || magic[3] > '4') throw "Invalid model file.";
+		int version = magic[3] - '0';
+		if (!in.read((char*)header, std::max(2, version) * sizeof(int))) throw "Invalid model file.";
+		if (header[0] < 0 || (header[1] != 0 && header[1] != Example::NUM_LABELS)) throw "Invalid model file.";
+		if (header[2] < 0 || header[2] >= TrainingParams::NUM_CRITERIA || header[3] < 0) throw "Invalid model file.";
+
+		// the number of attributes is 0, and not checked, for the files that do not store it
+		criterion = header[2];
+		num_attributes = header[3];
+		priors.resize(header[1]);
+		in.read((char*)priors.data(), priors.size() * sizeof(float));
+		trees.assign(header[0], DecisionTree());
+		construction.clear();
+		for (int i = 0; i < trees.size(); ++i) {
+			trees[i].loadBinary(in, version, num_attributes);
+		}
+	}
+
+	/**
+	 * Share the identical subtrees within every tree, see DecisionTree::compact.
+	 */
+	void RandomForest::compact() {
+		for (int i = 0; i < trees.size(); ++i) {
+			trees[i].compact();
+		}
+	}
+
+	/**
+	 * Return the sorted ids of the attributes that any tree splits on. Only these attributes
+	 * need to be computed for prediction.
+	 */
+	std::vector<int> RandomForest::usedAttributes() const {
+		std::vector<bool> used;
+		for (int i = 0; i < trees.size(); ++i) {
+			trees[i].markUsedAttributes(used);
+		}
+
+		std::vector<int> attributes;
+		for (int i = 0; i < used.size(); ++i) {
+			if (used[i]) attributes.push_back(i);
+		}
+		return attributes;
+	}
+
+	/**
+	 * Add the visit counts of the nodes of every tree, see DecisionTree::countVisits.
+	 */
+	void RandomForest::countVisits(const unsigned char* data, int stride, int count, std::vector<std::vector<long long> >& visits, const int* attribute_offsets) const {
+		visits.resize(trees.size());
+		for (int i = 0; i < trees.size(); ++i) {
+			trees[i].countVisits(data, stride, count, visits[i], attribute_offsets);
+		}
+	}
+
+	/**
+	 * Lay out every tree by its visit counts, see DecisionTree::reorder.
+	 */
+	void RandomForest::reorder(const std::vector<std::vector<long long> >& visits) {
+		if (visits.size() != trees.size()) throw "Visit counts do not match the forest.";
+
+		for (int i = 0; i < trees.size(); ++i) {
+			trees[i].reorder(visits[i]);
+		}
+	}
+
+	ForestStats RandomForest::stats() const {
+		ForestStats stats;
+		for (int i = 0; i < trees.size(); ++i) {
+			stats.trees.push_back(trees[i].stats());
+			if (i < construction.size()) std::copy(construction[i].stops, construction[i].stops + TreeStats::NUM_STOP_REASONS, stats.trees.back().stops);
+			stats.total.merge(stats.trees.back());
+		}
+		return stats;
+	}
+
+	/**
+	 * Return the label with the largest prior-weighted vote. If probabilities is not NULL,
+	 * it receives Example::NUM_LABELS entries with the normalized vote of every label.
+	 * A tree with histograms votes with the label distribution of the node it reaches,
+	 * otherwise it casts one vote for the node's label.
+	 */
+	int RandomForest::test(const unsigned char* data, float* probabilities) const {
 		if (trees.size() == 0) throw "Random forest is not constructed.";
 
-		QMap<unsigned char, float> histogram;
+		float votes[Example::NUM_LABELS] = {};
 		for (int i = 0; i < trees.size(); ++i) {
-			unsigned char label = trees[i].test(example);
-			if (!histogram.contains(label)) {
-				histogram[label] = 0;
+			addVotes(trees[i], trees[i].findNode(data), votes);
+		}
+
+		return selectLabel(votes, probabilities);
+	}
+
+	/**
+	 * Label count examples whose rows start stride bytes apart, with the same result as testing
+	 * them one by one. Every tree traverses a block of examples at once, see DecisionTree::findNodes.
+	 * If probabilities is not NULL, it receives Example::NUM_LABELS entries per example.
+	 * attribute_offsets is applied to every example as in DecisionTree::findNode, so with the offsets
+	 * of a patch in an image and a stride of one, a run of pixels is labelled straight from the image.
+	 */
+	void RandomForest::test(const unsigned char* data, int stride, int count, unsigned char* labels, float* probabilities, const int* attribute_offsets) const {
+		if (trees.size() == 0) throw "Random forest is not constructed.";
+
+		const int block_size = 256;
+		int node_ids[block_size];
+		float votes[block_size][Example::NUM_LABELS];
+		for (int begin = 0; begin < count; begin += block_size) {
+			int num_examples = std::min(block_size, count - begin);
+			const unsigned char* block = data + (size_t)begin * stride;
+
+			memset(votes, 0, sizeof(votes[0]) * num_examples);
+			for (int i = 0; i < trees.size(); ++i) {
+				trees[i].findNodes(block, stride, num_examples, node_ids, attribute_offsets);
+				for (int j = 0; j < num_examples; ++j) {
+					addVotes(trees[i], node_ids[j], votes[j]);
+				}
+			}
+
+			for (int j = 0; j < num_examples; ++j) {
+				labels[begin + j] = selectLabel(votes[j], probabilities ? probabilities + (size_t)(begin + j) * Example::NUM_LABELS : NULL);
+			}
+		}
+	}
+
+	int RandomForest::test(const Example& example, float* probabilities) const {
+		return test(example.data.data(), probabilities);
+	}
+
+	void RandomForest::addVotes(const DecisionTree& tree, int node_id, float* votes) const {
+		if (tree.hasHistograms()) {
+			const unsigned char* histogram = tree.histogram(node_id);
+			for (int label = 0; label < Example::NUM_LABELS; ++label) {
+				votes[label] += histogram[label] * (priors.size() == 0 ? 1.0f : priors[label]);
 			}
+		}
+		else {
+			unsigned char label = tree.nodeLabel(node_id);
 			if (priors.size() == 0) {
-				histogram[label]++;
+				votes[label]++;
 			}
 			else {
-				histogram[label] += priors[label];
+				votes[label] += priors[label];
 			}
 		}
+	}
 
+	unsigned char RandomForest::selectLabel(const float* votes, float* probabilities) const {
 		// find the maximum vote
-		int max_votes = 0;
+		float max_votes = 0;
+		float total_votes = 0;
 		unsigned char max_voted_label = Example::LABEL_UNKNOWN;
-		for (auto it = histogram.begin(); it != histogram.end(); ++it) {
-			if (it.value() > max_votes) {
-				max_votes = it.value();
-				max_voted_label = it.key();
+		for (int i = 0; i < Example::NUM_LABELS; ++i) {
+			total_votes += votes[i];
+			if (votes[i] > max_votes) {
+				max_votes = votes[i];
+				max_voted_label = i;
+			}
+		}
+
+		if (probabilities != NULL) {
+			for (int i = 0; i < Example::NUM_LABELS; ++i) {
+				probabilities[i] = total_votes > 0 ? votes[i] / total_votes : 0.0f;
 			}
 		}
 
@@ -1,64 +1,404 @@
 #pragma once
 
 #include <vector>
-#include <boost/shared_ptr.hpp>
-#include <QMap>
+#include <string>
+#include <iostream>
+#include <functional>
 #include <QString>
 #include <QDomElement>
 
 namespace rf {
+	class TreeStats;
+	class ProgressTracker;
+	class OOBAccumulator;
+	class TreeBuilder;
+
 	class Example {
 	public:
-		static enum { LABEL_WALL = 0, LABEL_WINDOW, LABEL_DOOR, LABEL_BALCONY, LABEL_SHOP, LABEL_ROOF, LABEL_SKY, LABEL_UNKNOWN };
+		enum { LABEL_WALL = 0, LABEL_WINDOW, LABEL_DOOR, LABEL_BALCONY, LABEL_SHOP, LABEL_ROOF, LABEL_SKY, LABEL_UNKNOWN, NUM_LABELS };
 
 	public:
 		std::vector<unsigned char> data;
 		unsigned char label;
 	};
 
+	/**
+	 * Training examples stored row by row in a single buffer.
+	 * Trees refer to the examples by their row index. After deduplicate(), every row stands for
+	 * weights[row] identical examples.
+	 */
+	class Dataset {
+	public:
+		int num_attributes;
+		int num_values;		// one more than the largest attribute value
+		std::vector<unsigned char> data;
+		std::vector<unsigned char> labels;
+		std::vector<unsigned int> weights;	// number of examples per row, or empty if every row is one example
+
+	public:
+		Dataset(int num_attributes);
+
+		size_t size() const { return labels.size(); }
+		const unsigned char* row(size_t index) const { return &data[index * num_attributes]; }
+		void push_back(const Example& example);
+		void append(const unsigned char* data, const unsigned char* labels, int count);
+		unsigned int weight(size_t index) const { return weights.size() > 0 ? weights[index] : 1; }
+		long long totalWeight() const;
+		void deduplicate(size_t begin = 0);
+		void clear();
+	};
+
+	/**
+	 * A view of rows first_row .. first_row + num_rows - 1 of a dataset in any layout: the value of attribute a
+	 * of row r of the block is at data[r * row_stride + a * column_stride], and its label at labels[r].
+	 */
+	class DataBlock {
+	public:
+		const unsigned char* data;
+		int row_stride;
+		int column_stride;
+		const unsigned char* labels;
+		size_t first_row;
+		int num_rows;
+	};
+
+	/**
+	 * Training rows that are read block by block, in order, such as a ChunkedDataset on disk.
+	 * scan() may be called from several threads at a time. inMemory() tells whether the rows
+	 * are held in memory anyway, so that keeping a little state per row is cheap in comparison.
+	 */
+	class BlockSource {
+	public:
+		virtual ~BlockSource() {}
+
+		virtual size_t numRows() const = 0;
+		virtual int numAttributes() const = 0;
+		virtual int numValues() const = 0;
+		virtual void scan(const std::function<void(const DataBlock&)>& visit) const = 0;
+		virtual bool inMemory() const { return false; }
+	};
+
+	/**
+	 * Structural statistics of a constructed tree. Leaf purity is the fraction of
+	 * the training examples at a leaf that carry the majority label.
+	 * The node counts describe the tree as it is traversed, while num_stored_nodes and bytes
+	 * describe its storage, which is smaller once identical subtrees are shared. stops counts
+	 * the nodes that construction left as leaves, or the children it did not build, per reason,
+	 * as recorded in ConstructionStats; it is zero for a tree that was not built by the forest.
+	 */
+	class TreeStats {
+	public:
+		enum { STOP_PURE = 0, STOP_MAX_DEPTH, STOP_MIN_SAMPLES_SPLIT, STOP_MIN_SAMPLES_LEAF, STOP_MIN_GAIN, STOP_MAX_LEAF_NODES, STOP_BUDGET, STOP_NO_SPLIT, NUM_STOP_REASONS };
+
+	public:
+		int num_nodes;
+		int num_stored_nodes;
+		int num_leaves;
+		int num_children;
+		int max_depth;
+		std::vector<int> leaf_depth_histogram;
+		long long num_leaf_examples;
+		int min_leaf_examples;
+		int max_leaf_examples;
+		int num_single_example_leaves;
+		double leaf_purity_sum;
+		size_t bytes;
+		long long stops[NUM_STOP_REASONS];
+
+	public:
+		TreeStats();
+
+		static std::string stopReasonName(int reason);
+
+		void addNode(int depth, int num_children);
+		void addLeaf(int depth, int num_examples, float purity);
+		void merge(const TreeStats& other);
+		float branchingFactor() const;
+		float averageLeafExamples() const;
+		float averageLeafPurity() const;
+	};
+
+	class ForestStats {
+	public:
+		std::vector<TreeStats> trees;
+		TreeStats total;
+
+	public:
+		void print() const;
+	};
+
+	/**
+	 * How often every attribute is chosen to split a node, and the impurity the splits remove,
+	 * weighted by the number of examples at the node.
+	 */
+	class FeatureImportance {
+	public:
+		std::vector<long long> split_counts;
+		std::vector<double> gains;
+
+	public:
+		void resize(int num_attributes);
+		void addSplit(int attribute, double gain);
+		void merge(const FeatureImportance& other);
+		void print(int width) const;
+	};
+
+	/**
+	 * What the construction of a tree records besides the tree: the splits it made per attribute, and the nodes
+	 * it left as leaves, or the children it did not build, per TreeStats stop reason.
+	 */
+	class ConstructionStats {
+	public:
+		FeatureImportance importance;
+		long long stops[TreeStats::NUM_STOP_REASONS];
+
+	public:
+		ConstructionStats();
+	};
+
+	/**
+	 * Out-of-bag estimate of the forest's error. Every training example is labelled by the trees that did
+	 * not draw it, and confusion[truth * Example::NUM_LABELS + label] sums the weights of the examples with
+	 * the true and the predicted label. error_curve[k] is the error of the first k + 1 trees.
+	 */
+	class OOBEstimate {
+	public:
+		std::vector<double> confusion;
+		std::vector<float> error_curve;
+
+	public:
+		double numExamples() const;
+		float error() const;
+		void print() const;
+	};
+
+	/**
+	 * Snapshot of a long-running job. seconds_remaining and oob_error are negative while no estimate is available.
+	 */
+	class Progress {
+	public:
+		std::string stage;
+		int num_trees;
+		int num_trees_built;
+		long long num_examples_processed;
+		long long num_nodes_built;
+		float fraction;
+		float seconds_remaining;
+		float oob_error;
+
+	public:
+		Progress(const std::string& stage);
+
+		std::string toString() const;
+	};
+
+	/**
+	 * Receives progress reports from training or testing and lets the caller request
+	 * cooperative cancellation. Both methods may be called from a worker thread.
+	 */
+	class ProgressMonitor {
+	public:
+		virtual ~ProgressMonitor() {}
+
+		virtual void onProgress(const Progress& progress) = 0;
+		virtual bool isCancelled() = 0;
+	};
+
+	/**
+	 * Parameters of tree and forest construction.
+	 * With leaf_histograms, every node keeps the label distribution of its training examples,
+	 * quantized to one byte per label, and the forest averages these distributions instead of
+	 * counting one hard vote per tree. With SPLIT_THRESHOLD, every node has two children, for
+	 * value <= threshold and value > threshold, instead of one child per attribute value.
+	 * The split minimizes the impurity given by criterion: the entropy, the Gini impurity, which
+	 * needs no logarithm, or the entropy with n * log2(n) looked up from a table for small counts.
+	 * With extra_trees, every node scores only num_random_splits random attributes with random
+	 * thresholds (extremely randomized trees) instead of searching sqrt(#attributes) attributes.
+	 *
+	 * Besides purity and max_depth, a node stays a leaf if it has fewer than min_samples_split examples,
+	 * if its split decreases the impurity per example by less than min_gain, or if its children would make
+	 * the tree exceed max_leaf_nodes leaves (0 for no limit), counting the leaves in the order they are built.
+	 * A threshold split leaves at least min_samples_leaf examples on either side, and a multiway split does not
+	 * build the children with fewer examples, which are then labelled by their parent.
+	 *
+	 * With GROWTH_BEST_FIRST, the tree grows by splitting the leaf whose split removes the most impurity,
+	 * weighted by its number of examples, instead of depth-first, so that max_leaf_nodes, max_nodes and
+	 * max_bytes keep the most useful splits. A split is not made if the tree would exceed max_nodes nodes,
+	 * or max_bytes bytes of nodes, child slots and histograms as counted by TreeStats (0 for no limit).
+	 * With GROWTH_LEVEL_WISE, all the nodes of a depth are split at once after a sequential pass over the rows.
+	 */
+	class TrainingParams {
+	public:
+		enum { SPLIT_MULTIWAY = 0, SPLIT_THRESHOLD };
+		enum { CRITERION_ENTROPY = 0, CRITERION_GINI, CRITERION_ENTROPY_TABLE, NUM_CRITERIA };
+		enum { GROWTH_DEPTH_FIRST = 0, GROWTH_BEST_FIRST, GROWTH_LEVEL_WISE };
+
+	public:
+		int num_trees;
+		float ratio;				// fraction of the examples drawn for each tree
+		int max_depth;
+		bool sample_attributes;		// consider sqrt(#attributes) random attributes per node
+		bool leaf_histograms;
+		int split_type;
+		int criterion;
+		bool extra_trees;
+		int num_random_splits;		// candidate splits per node with extra_trees
+		int min_samples_split;
+		int min_samples_leaf;
+		float min_gain;
+		int max_leaf_nodes;
+		int growth;
+		int max_nodes;				// per tree
+		size_t max_bytes;			// per tree
+		bool poisson_bagging;		// draw every example Poisson(ratio) times instead of a subset without replacement
+		int num_threads;			// number of trees built at a time
+		unsigned int seed;			// the samples and attributes drawn depend only on the seed
+		bool estimate_oob;			// label the examples left out of every tree's sample, see OOBEstimate
+		std::vector<float> priors;	// one weight per label, or empty for plain majority votes
+
+	public:
+		TrainingParams();
+
+		static std::string criterionName(int criterion);
+	};
+
+	/**
+	 * The weight of every row in a tree's sample, read in row order by next() and again after restart(). The
+	 * weights are either given, or drawn on every pass as RandomForest draws the sample of the tree_id-th tree,
+	 * so that the level-wise construction keeps no array per row.
+	 */
+	class RowSample {
+	private:
+		const unsigned int* weights;	// the given weights, or NULL
+		unsigned long long key;
+		bool poisson_bagging;
+		float ratio;
+		size_t num_rows;
+		size_t row;
+		long long needed;				// the rows left to select without poisson_bagging
+
+	public:
+		RowSample(const unsigned int* weights, size_t num_rows);
+		RowSample(const TrainingParams& params, int tree_id, size_t num_rows);
+
+		void restart();
+		unsigned int next();
+	};
+
+	/**
+	 * A node of a decision tree. The nodes of a tree live in a single array owned by the tree,
+	 * and a node refers to its children through a block of slots in the tree's child table,
+	 * one slot per attribute value.
+	 */
 	class DecisionTreeNode {
 	public:
 		int split_attribute_id;
+		int children_offset;	// first slot in the child table, or -1 for a leaf
 		unsigned char label;
-		int depth;
-		QMap<int, boost::shared_ptr<DecisionTreeNode>> children;
+		unsigned char threshold;	// with threshold splits, values up to the threshold take the first slot
+		int num_examples;
+		float purity;
 
 	public:
-		DecisionTreeNode(int depth);
+		DecisionTreeNode();
 
-		unsigned char test(const boost::shared_ptr<Example>& example);
-		QDomElement save(QDomDocument& doc);
-		unsigned char setLabelFromChildren(const QMap<unsigned char, float>& priors);
+		bool isLeaf() const { return children_offset < 0; }
 	};
 
+	/**
+	 * A decision tree in a flat array of nodes. After compact(), identical subtrees are stored once
+	 * and several parents may refer to the same child, so the nodes form a DAG. A child always has
+	 * a larger index than its parents. Every internal node has numSlots() child slots: one per attribute
+	 * value for multiway splits, or two for threshold splits.
+	 */
 	class DecisionTree {
 	private:
-		boost::shared_ptr<DecisionTreeNode> root;
+		std::vector<DecisionTreeNode> nodes;	// the root is nodes[0]
+		std::vector<int> children;				// child node index per (node, value) slot, or -1 for unseen values
+		std::vector<unsigned char> histograms;	// Example::NUM_LABELS quantized counts per node, or empty
+		int num_values;
+		int split_type;							// TrainingParams::SPLIT_MULTIWAY or SPLIT_THRESHOLD
+
+		friend class TreeBuilder;
 
 	public:
 		DecisionTree();
 
-		void construct(const std::vector<boost::shared_ptr<Example>>& examples, bool sample_attributes, int max_depth, const QMap<unsigned char, float>& priors);
-		int test(const boost::shared_ptr<Example>& example);
+		bool construct(const Dataset& dataset, const std::vector<unsigned int>& indices, const TrainingParams& params, ProgressTracker* tracker = NULL, const unsigned int* weights = NULL, ConstructionStats* construction = NULL);
+		bool construct(const BlockSource& source, const RowSample& sample, const TrainingParams& params, ProgressTracker* tracker = NULL, ConstructionStats* construction = NULL);
+		int findNode(const unsigned char* data, const int* attribute_offsets = NULL) const;
+		void findNodes(const unsigned char* data, int stride, int count, int* node_ids, const int* attribute_offsets = NULL) const;
+		int test(const unsigned char* data) const;
+		int test(const Example& example) const;
+		int numNodes() const { return nodes.size(); }
+		int numValues() const { return num_values; }
+		bool thresholdSplits() const { return split_type == TrainingParams::SPLIT_THRESHOLD; }
+		int numSlots() const { return thresholdSplits() ? 2 : num_values; }
+		const DecisionTreeNode& node(int node_id) const { return nodes[node_id]; }
+		int slot(int node_id, int value) const { return thresholdSplits() ? value > nodes[node_id].threshold : (value < num_values ? value : -1); }
+		int childAt(int node_id, int slot) const { return children[nodes[node_id].children_offset + slot]; }
+		int child(int node_id, int value) const { int s = slot(node_id, value); return s < 0 ? -1 : childAt(node_id, s); }
+		unsigned char nodeLabel(int node_id) const { return nodes[node_id].label; }
+		bool hasHistograms() const { return histograms.size() > 0; }
+		const unsigned char* histogram(int node_id) const { return &histograms[node_id * Example::NUM_LABELS]; }
+		size_t bytes() const { return nodes.size() * sizeof(DecisionTreeNode) + histograms.size() + children.size() * sizeof(int); }
 		void save(const QString& filename);
 		QDomElement save(QDomDocument& doc);
+		TreeStats stats() const;
+		int compact();
+		void markUsedAttributes(std::vector<bool>& used) const;
+		void countVisits(const unsigned char* data, int stride, int count, std::vector<long long>& visits, const int* attribute_offsets = NULL) const;
+		void reorder(const std::vector<long long>& visits);
+		void saveBinary(std::ostream& out) const;
+		void loadBinary(std::istream& in, int version = 2, int num_attributes = 0);
 
 	private:
-		boost::shared_ptr<DecisionTreeNode> constructNodes(const std::vector<boost::shared_ptr<Example>>& examples, int depth, bool sample_attributes, int max_depth);
-		float calculateEntropy(const std::vector<boost::shared_ptr<Example>>& examples, int split_attribute);
+		unsigned char setLabelFromChildren(int node_id, const std::vector<float>& priors);
+		QDomElement saveNode(QDomDocument& doc, int node_id);
+		void collectStats(int node_id, int depth, TreeStats& stats) const;
 	};
 
 	class RandomForest {
 	private:
 		std::vector<DecisionTree> trees;
-		QMap<unsigned char, float> priors;
+		int num_attributes;			// the attributes of the training rows, or 0 if unknown
+		std::vector<float> priors;	// one weight per label, or empty for plain majority votes
+		int criterion;				// the impurity criterion the trees were built with
+		OOBEstimate oob_estimate;	// empty unless constructed with estimate_oob
+		FeatureImportance feature_importance;
+		std::vector<ConstructionStats> construction;	// per tree, empty for a loaded forest
 
 	public:
 		RandomForest();
 
-		void construct(const std::vector<boost::shared_ptr<Example>>& examples, int num_trees, float ratio, int max_depth, const QMap<unsigned char, float>& priors);
+		bool construct(const Dataset& dataset, const TrainingParams& params, ProgressMonitor* monitor = NULL);
+		bool construct(const BlockSource& source, const TrainingParams& params, ProgressMonitor* monitor = NULL);
 		void save(const QString& filename);
-		int test(const boost::shared_ptr<Example>& example);
+		void saveBinary(const std::string& filename) const;
+		void loadBinary(const std::string& filename);
+		void compact();
+		std::vector<int> usedAttributes() const;
+		void countVisits(const unsigned char* data, int stride, int count, std::vector<std::vector<long long> >& visits, const int* attribute_offsets = NULL) const;
+		void reorder(const std::vector<std::vector<long long> >& visits);
+		int test(const unsigned char* data, float* probabilities = NULL) const;
+		int test(const Example& example, float* probabilities = NULL) const;
+		void test(const unsigned char* data, int stride, int count, unsigned char* labels, float* probabilities = NULL, const int* attribute_offsets = NULL) const;
+		ForestStats stats() const;
+		int numTrees() const { return trees.size(); }
+		const DecisionTree& tree(int index) const { return trees[index]; }
+		const std::vector<float>& getPriors() const { return priors; }
+		int getCriterion() const { return criterion; }
+		int numAttributes() const { return num_attributes; }
+		const OOBEstimate& oob() const { return oob_estimate; }
+		const FeatureImportance& importance() const { return feature_importance; }
+
+	private:
+		bool constructTrees(const TrainingParams& params, const std::function<bool(int tree_id)>& construct_tree);
+		bool constructTree(const Dataset& dataset, const TrainingParams& params, int tree_id, ProgressTracker* tracker, OOBAccumulator* oob);
+		bool constructTree(const BlockSource& source, const TrainingParams& params, int tree_id, ProgressTracker* tracker);
+		void addOOBVotes(const Dataset& dataset, const TrainingParams& params, int tree_id, const std::vector<unsigned int>& indices, const std::vector<unsigned int>& weights, OOBAccumulator& oob, ProgressTracker* tracker);
+		void addVotes(const DecisionTree& tree, int node_id, float* votes) const;
+		unsigned char selectLabel(const float* votes, float* probabilities) const;
 	};
 
 }
\ No newline at end of file
@@ -0,0 +1,112 @@
+#include "StratifiedSampler.h"
+#include <algorithm>
+#include <cstdio>
+
+namespace rf {
+
+	/**
+	 * targets and ratios have one entry per label, or a single entry for all the labels, or none.
+	 */
+	StratifiedSampler::StratifiedSampler(int num_attributes, const std::vector<int>& targets, const std::vector<float>& ratios, unsigned int seed) : rng(seed) {
+		this->num_attributes = num_attributes;
+		this->targets.assign(Example::NUM_LABELS, -1);
+		this->ratios.assign(Example::NUM_LABELS, 1.0f);
+		for (int label = 0; label < Example::NUM_LABELS; ++label) {
+			if (targets.size() == 1) this->targets[label] = targets[0];
+			else if (label < targets.size()) this->targets[label] = targets[label];
+			if (ratios.size() == 1) this->ratios[label] = ratios[0];
+			else if (label < ratios.size()) this->ratios[label] = ratios[label];
+		}
+
+		num_seen.assign(Example::NUM_LABELS, 0);
+		num_kept.assign(Example::NUM_LABELS, 0);
+		reservoirs.resize(Example::NUM_LABELS);
+		num_considered.assign(Example::NUM_LABELS, 0);
+	}
+
+	/**
+	 * Offer count examples of the current image, stored row by row in data, with their labels.
+	 */
+	void StratifiedSampler::add(const unsigned char* data, const unsigned char* labels, int count) {
+		std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+		for (int i = 0; i < count; ++i) {
+			unsigned char label = labels[i];
+			const unsigned char* row = data + (size_t)i * num_attributes;
+			num_seen[label]++;
+
+			if (ratios[label] < 1.0f && uniform(rng) >= ratios[label]) continue;
+			num_considered[label]++;
+
+			std::vector<unsigned char>& reservoir = reservoirs[label];
+			if (targets[label] < 0 || num_considered[label] <= targets[label]) {
+				reservoir.insert(reservoir.end(), row, row + num_attributes);
+			}
+			else {
+				// keep the new example with probability target / considered, in place of a random one
+				long long slot = std::uniform_int_distribution<long long>(0, num_considered[label] - 1)(rng);
+				if (slot < targets[label]) {
+					std::copy(row, row + num_attributes, reservoir.begin() + slot * num_attributes);
+				}
+			}
+		}
+	}
+
+	/**
+	 * Append the examples kept from the current image to the dataset, and start the next image.
+	 */
+	void StratifiedSampler::endImage(Dataset& dataset) {
+		for (int label = 0; label < Example::NUM_LABELS; ++label) {
+			std::vector<unsigned char>& reservoir = reservoirs[label];
+			int count = reservoir.size() / num_attributes;
+
+			std::vector<unsigned char> labels(count, label);
+			dataset.append(reservoir.data(), labels.data(), count);
+			num_kept[label] += count;
+
+			reservoir.clear();
+			num_considered[label] = 0;
+		}
+	}
+
+	/**
+	 * Return the number of seen examples that every kept example stands for, per label.
+	 */
+	std::vector<float> StratifiedSampler::weights() const {
+		std::vector<float> weights(Example::NUM_LABELS, 0.0f);
+		for (int label = 0; label < Example::NUM_LABELS; ++label) {
+			if (num_kept[label] > 0) weights[label] = (float)num_seen[label] / num_kept[label];
+		}
+		return weights;
+	}
+
+	/**
+	 * Return the vote priors that make a forest trained on the kept examples vote like one trained on
+	 * all of them with the given priors (or with none, if empty): every prior is scaled by the sampling
+	 * weight of its label. The result is normalized so that the smallest non-zero prior is 1.
+	 */
+	std::vector<float> StratifiedSampler::priors(const std::vector<float>& priors) const {
+		std::vector<float> result = weights();
+		float min_prior = 0.0f;
+		for (int label = 0; label < Example::NUM_LABELS; ++label) {
+			if (priors.size() > 0) result[label] *= priors[label];
+			if (result[label] > 0 && (min_prior == 0.0f || result[label] < min_prior)) min_prior = result[label];
+		}
+
+		if (min_prior > 0) {
+			for (int label = 0; label < Example::NUM_LABELS; ++label) {
+				result[label] /= min_prior;
+			}
+		}
+		return result;
+	}
+
+	void StratifiedSampler::print() const {
+		printf("Label      seen      kept   weight\n");
+		for (int label = 0; label < Example::NUM_LABELS; ++label) {
+			if (num_seen[label] == 0) continue;
+			printf("%5d %9lld %9lld %8.2f\n", label, num_seen[label], num_kept[label], num_kept[label] > 0 ? (float)num_seen[label] / num_kept[label] : 0.0f);
+		}
+	}
+
+}
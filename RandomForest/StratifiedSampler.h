@@ -0,0 +1,37 @@
+#pragma once
+
+#include <vector>
+#include <random>
+#include "RandomForest.h"
+
+namespace rf {
+	/**
+	 * Class-balanced subsampling of the examples of one image at a time. Of the examples of each label,
+	 * a fraction ratios[label] is considered, and at most targets[label] of those are kept per image by
+	 * reservoir sampling. The counts of seen and kept examples give the sampling weight of every label,
+	 * from which the vote priors for the subsampled dataset are derived.
+	 */
+	class StratifiedSampler {
+	public:
+		std::vector<int> targets;		// examples kept per label and image, or negative for no limit
+		std::vector<float> ratios;		// fraction of the examples of each label considered
+		std::vector<long long> num_seen;
+		std::vector<long long> num_kept;
+
+	private:
+		int num_attributes;
+		std::mt19937 rng;
+		std::vector<std::vector<unsigned char> > reservoirs;
+		std::vector<long long> num_considered;	// examples considered per label in the current image
+
+	public:
+		StratifiedSampler(int num_attributes, const std::vector<int>& targets, const std::vector<float>& ratios, unsigned int seed = 0);
+
+		void add(const unsigned char* data, const unsigned char* labels, int count);
+		void endImage(Dataset& dataset);
+		std::vector<float> weights() const;
+		std::vector<float> priors(const std::vector<float>& priors) const;
+		void print() const;
+	};
+
+}
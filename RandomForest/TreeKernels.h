@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include "RandomForest.h"
+
+namespace rf {
+	/**
+	 * Batch traversal kernels of DecisionTree::findNodes. Every kernel is in a translation unit of its own that is
+	 * compiled for its instruction set (/arch:AVX2 or -mavx2, -mavx512f), while the rest of the program is built for
+	 * the baseline, and findNodes calls a kernel only on CPUs that support it. A kernel built without its
+	 * instruction set returns 0.
+	 *
+	 * The examples advance through the tree 16 (AVX-512) or 8 (AVX2) at a time in lockstep, and the kernels
+	 * return the number of examples done; the rest are left to findNode.
+	 */
+	int findNodesAVX512(const DecisionTreeNode* nodes, const int* children, int num_values, bool thresholds, const unsigned char* data, int stride, int count, const int* attribute_offsets, int* node_ids);
+	int findNodesAVX2(const DecisionTreeNode* nodes, const int* children, int num_values, bool thresholds, const unsigned char* data, int stride, int count, const int* attribute_offsets, int* node_ids);
+
+	// The kernels read the nodes as an array of ints.
+	static_assert(sizeof(DecisionTreeNode) % sizeof(int) == 0, "DecisionTreeNode must be a whole number of ints.");
+	static const int NODE_INTS = sizeof(DecisionTreeNode) / sizeof(int);
+	static const int SPLIT_ATTRIBUTE_INT = offsetof(DecisionTreeNode, split_attribute_id) / sizeof(int);
+	static const int CHILDREN_OFFSET_INT = offsetof(DecisionTreeNode, children_offset) / sizeof(int);
+	static const int THRESHOLD_INT = offsetof(DecisionTreeNode, threshold) / sizeof(int);
+	static const int THRESHOLD_SHIFT = offsetof(DecisionTreeNode, threshold) % sizeof(int) * 8;
+}
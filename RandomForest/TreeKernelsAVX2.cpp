@@ -0,0 +1,59 @@
+#include "TreeKernels.h"
+#include <cstdint>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace rf {
+
+	/**
+	 * See findNodesAVX512 for how the attribute bytes are gathered.
+	 */
+	int findNodesAVX2(const DecisionTreeNode* nodes, const int* children, int num_values, bool thresholds, const unsigned char* data, int stride, int count, const int* attribute_offsets, int* node_ids) {
+#ifdef __AVX2__
+		const int* node_ints = (const int*)nodes;
+		const int* words = (const int*)((uintptr_t)data & ~(uintptr_t)3);
+		int data_offset = data - (const unsigned char*)words;
+
+		const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+		const __m256i zero = _mm256_setzero_si256();
+		const __m256i none = _mm256_set1_epi32(-1);
+		const __m256i max_value = _mm256_set1_epi32(num_values - 1);
+
+		int i = 0;
+		for (; i + 8 <= count; i += 8) {
+			__m256i row = _mm256_add_epi32(_mm256_set1_epi32(data_offset + i * stride), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(stride)));
+			__m256i node = zero;
+			__m256i active = none;
+			while (!_mm256_testz_si256(active, active)) {
+				__m256i node_base = _mm256_mullo_epi32(node, _mm256_set1_epi32(NODE_INTS));
+				__m256i attribute = _mm256_mask_i32gather_epi32(zero, node_ints + SPLIT_ATTRIBUTE_INT, node_base, active, 4);
+				__m256i offset = _mm256_mask_i32gather_epi32(none, node_ints + CHILDREN_OFFSET_INT, node_base, active, 4);
+				active = _mm256_andnot_si256(_mm256_cmpgt_epi32(zero, offset), active);
+				if (attribute_offsets) attribute = _mm256_mask_i32gather_epi32(zero, attribute_offsets, attribute, active, 4);
+
+				__m256i byte = _mm256_add_epi32(row, attribute);
+				__m256i word = _mm256_mask_i32gather_epi32(zero, words, _mm256_srli_epi32(byte, 2), active, 4);
+				__m256i value = _mm256_and_si256(_mm256_srlv_epi32(word, _mm256_slli_epi32(_mm256_and_si256(byte, _mm256_set1_epi32(3)), 3)), _mm256_set1_epi32(0xFF));
+				if (thresholds) {
+					__m256i threshold = _mm256_mask_i32gather_epi32(zero, node_ints + THRESHOLD_INT, node_base, active, 4);
+					threshold = _mm256_and_si256(_mm256_srli_epi32(threshold, THRESHOLD_SHIFT), _mm256_set1_epi32(0xFF));
+					value = _mm256_srli_epi32(_mm256_cmpgt_epi32(value, threshold), 31);
+				}
+				else {
+					active = _mm256_andnot_si256(_mm256_cmpgt_epi32(value, max_value), active);
+				}
+
+				__m256i child = _mm256_mask_i32gather_epi32(none, children, _mm256_add_epi32(offset, value), active, 4);
+				active = _mm256_andnot_si256(_mm256_cmpgt_epi32(zero, child), active);
+				node = _mm256_blendv_epi8(node, child, active);
+			}
+			_mm256_storeu_si256((__m256i*)(node_ids + i), node);
+		}
+		return i;
+#else
+		return 0;
+#endif
+	}
+
+}
@@ -0,0 +1,62 @@
+#include "TreeKernels.h"
+#include <cstdint>
+#ifdef __AVX512F__
+#include <immintrin.h>
+#endif
+
+namespace rf {
+
+	/**
+	 * An attribute byte is gathered as the aligned 32-bit word that contains it, so the loads never cross
+	 * a word boundary past the end of the data. With thresholds, the child slot is the comparison of the
+	 * value with the node's threshold instead of the value itself. The v120 toolset has no /arch:AVX512,
+	 * so the Visual Studio build leaves this kernel empty.
+	 */
+	int findNodesAVX512(const DecisionTreeNode* nodes, const int* children, int num_values, bool thresholds, const unsigned char* data, int stride, int count, const int* attribute_offsets, int* node_ids) {
+#ifdef __AVX512F__
+		const int* node_ints = (const int*)nodes;
+		const int* words = (const int*)((uintptr_t)data & ~(uintptr_t)3);
+		int data_offset = data - (const unsigned char*)words;
+
+		const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+		const __m512i zero = _mm512_setzero_si512();
+		const __m512i none = _mm512_set1_epi32(-1);
+		const __m512i values = _mm512_set1_epi32(num_values);
+
+		int i = 0;
+		for (; i + 16 <= count; i += 16) {
+			__m512i row = _mm512_add_epi32(_mm512_set1_epi32(data_offset + i * stride), _mm512_mullo_epi32(lanes, _mm512_set1_epi32(stride)));
+			__m512i node = zero;
+			__mmask16 active = 0xFFFF;
+			while (active) {
+				__m512i node_base = _mm512_mullo_epi32(node, _mm512_set1_epi32(NODE_INTS));
+				__m512i attribute = _mm512_mask_i32gather_epi32(zero, active, node_base, node_ints + SPLIT_ATTRIBUTE_INT, 4);
+				__m512i offset = _mm512_mask_i32gather_epi32(none, active, node_base, node_ints + CHILDREN_OFFSET_INT, 4);
+				active = _mm512_mask_cmpge_epi32_mask(active, offset, zero);
+				if (attribute_offsets) attribute = _mm512_mask_i32gather_epi32(zero, active, attribute, attribute_offsets, 4);
+
+				__m512i byte = _mm512_add_epi32(row, attribute);
+				__m512i word = _mm512_mask_i32gather_epi32(zero, active, _mm512_srli_epi32(byte, 2), words, 4);
+				__m512i value = _mm512_and_si512(_mm512_srlv_epi32(word, _mm512_slli_epi32(_mm512_and_si512(byte, _mm512_set1_epi32(3)), 3)), _mm512_set1_epi32(0xFF));
+				if (thresholds) {
+					__m512i threshold = _mm512_mask_i32gather_epi32(zero, active, node_base, node_ints + THRESHOLD_INT, 4);
+					threshold = _mm512_and_si512(_mm512_srli_epi32(threshold, THRESHOLD_SHIFT), _mm512_set1_epi32(0xFF));
+					value = _mm512_maskz_mov_epi32(_mm512_cmpgt_epi32_mask(value, threshold), _mm512_set1_epi32(1));
+				}
+				else {
+					active = _mm512_mask_cmplt_epi32_mask(active, value, values);
+				}
+
+				__m512i child = _mm512_mask_i32gather_epi32(none, active, _mm512_add_epi32(offset, value), children, 4);
+				active = _mm512_mask_cmpge_epi32_mask(active, child, zero);
+				node = _mm512_mask_blend_epi32(active, node, child);
+			}
+			_mm512_storeu_si512(node_ids + i, node);
+		}
+		return i;
+#else
+		return 0;
+#endif
+	}
+
+}
@@ -1,8 +1,211 @@
 #include "MainWindow.h"
 #include <QtWidgets/QApplication>
+#include <csignal>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <sstream>
+#include <iostream>
+#include "ECPPipeline.h"
+
+/**
+ * Prints the progress on a single console line, and cancels the job on Ctrl+C.
+ */
+class ConsoleProgressMonitor : public rf::ProgressMonitor {
+public:
+	static volatile std::sig_atomic_t interrupted;
+
+public:
+	void onProgress(const rf::Progress& progress) {
+		printf("\r%s        ", progress.toString().c_str());
+		if (progress.fraction >= 1.0f) printf("\n");
+		fflush(stdout);
+	}
+
+	bool isCancelled() {
+		return interrupted != 0;
+	}
+
+	static void onInterrupt(int) {
+		interrupted = 1;
+	}
+};
+
+volatile std::sig_atomic_t ConsoleProgressMonitor::interrupted = 0;
 
 int main(int argc, char *argv[])
 {
+	// headless mode: run the ECP pipeline on the console without opening the window
+	//   --train                 train and test a forest
+	//   --stride <n>            take a training patch every n pixels
+	//   --class-target <n,...>  keep at most n training patches per label and image (one value, or one per label)
+	//   --class-ratio <r,...>   consider a fraction r of the training patches of each label (one value, or one per label)
+	//   --dedup                 store identical training patches once with a weight
+	//   --threads <n>           build n trees at a time (default: one per hardware thread)
+	//   --poisson               draw every training patch Poisson(ratio) times for each tree
+	//   --threshold-splits      split the tree nodes in two on value <= threshold
+	//   --extra-trees <k>       score only k random splits per node (extremely randomized trees)
+	//   --min-samples-split <n> do not split the nodes with fewer than n training patches
+	//   --min-samples-leaf <n>  do not make the leaves with fewer than n training patches
+	//   --min-gain <g>          do not split the nodes whose impurity decreases by less than g per patch
+	//   --max-leaf-nodes <n>    stop growing a tree at n leaves
+	//   --best-first            grow the trees by splitting the leaf with the largest impurity decrease first
+	//   --level-wise            grow the trees one depth at a time, with a sequential pass over the patches per depth
+	//   --out-of-core <file>    write the training patches to a chunked file and train from it, level-wise (no --oob)
+	//   --max-tree-nodes <n>    stop growing a tree at n nodes
+	//   --max-tree-kb <n>       stop growing a tree at n KB of nodes, child slots and histograms
+	//   --criterion <name>      split by entropy (default), gini or entropy-table
+	//   --benchmark-criteria    compare the training time and out-of-bag error of every criterion, without testing
+	//   --oob                   print the out-of-bag error and confusion matrix of the training patches
+	//   --no-test               skip labelling the test images after training
+	//   --export-cpp <file>     also compile the trained forest into C++ source
+	//   --save-model <file>     also save the trained forest in the binary model format
+	//   --profile-layout <dir>  lay out the trained forest by how often the patches of the images in dir visit its nodes
+	//   --test-model <file>     test a forest loaded from a binary model file
+	//   --test-generated        test the forest compiled into this executable (RF_GENERATED_FOREST builds)
+	bool train = false;
+	bool test_generated = false;
+	std::string test_model;
+	ECPOptions options;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--train") == 0) {
+			train = true;
+		}
+		else if (strcmp(argv[i], "--stride") == 0 && i + 1 < argc) {
+			options.stride = std::max(1, atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--class-target") == 0 && i + 1 < argc) {
+			std::stringstream list(argv[++i]);
+			std::string value;
+			while (std::getline(list, value, ',')) options.class_targets.push_back(atoi(value.c_str()));
+		}
+		else if (strcmp(argv[i], "--class-ratio") == 0 && i + 1 < argc) {
+			std::stringstream list(argv[++i]);
+			std::string value;
+			while (std::getline(list, value, ',')) options.class_ratios.push_back(atof(value.c_str()));
+		}
+		else if (strcmp(argv[i], "--dedup") == 0) {
+			options.deduplicate = true;
+		}
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+			options.num_threads = std::max(1, atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--poisson") == 0) {
+			options.poisson_bagging = true;
+		}
+		else if (strcmp(argv[i], "--threshold-splits") == 0) {
+			options.threshold_splits = true;
+		}
+		else if (strcmp(argv[i], "--extra-trees") == 0 && i + 1 < argc) {
+			options.num_random_splits = std::max(1, atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--min-samples-split") == 0 && i + 1 < argc) {
+			options.min_samples_split = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--min-samples-leaf") == 0 && i + 1 < argc) {
+			options.min_samples_leaf = std::max(1, atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--min-gain") == 0 && i + 1 < argc) {
+			options.min_gain = atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--max-leaf-nodes") == 0 && i + 1 < argc) {
+			options.max_leaf_nodes = std::max(0, atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--best-first") == 0) {
+			options.best_first = true;
+		}
+		else if (strcmp(argv[i], "--level-wise") == 0) {
+			options.level_wise = true;
+		}
+		else if (strcmp(argv[i], "--out-of-core") == 0 && i + 1 < argc) {
+			options.out_of_core = argv[++i];
+		}
+		else if (strcmp(argv[i], "--max-tree-nodes") == 0 && i + 1 < argc) {
+			options.max_tree_nodes = std::max(0, atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--max-tree-kb") == 0 && i + 1 < argc) {
+			options.max_tree_bytes = (size_t)std::max(0, atoi(argv[++i])) * 1024;
+		}
+		else if (strcmp(argv[i], "--criterion") == 0 && i + 1 < argc) {
+			std::string name = argv[++i];
+			options.criterion = -1;
+			for (int criterion = 0; criterion < rf::TrainingParams::NUM_CRITERIA; ++criterion) {
+				if (rf::TrainingParams::criterionName(criterion) == name) options.criterion = criterion;
+			}
+			if (options.criterion < 0) {
+				std::cout << "Error: unknown criterion " << name << "." << std::endl;
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--benchmark-criteria") == 0) {
+			options.benchmark_criteria = true;
+		}
+		else if (strcmp(argv[i], "--oob") == 0) {
+			options.estimate_oob = true;
+		}
+		else if (strcmp(argv[i], "--no-test") == 0) {
+			options.test = false;
+		}
+		else if (strcmp(argv[i], "--export-cpp") == 0 && i + 1 < argc) {
+			options.export_cpp = argv[++i];
+		}
+		else if (strcmp(argv[i], "--save-model") == 0 && i + 1 < argc) {
+			options.save_model = argv[++i];
+		}
+		else if (strcmp(argv[i], "--profile-layout") == 0 && i + 1 < argc) {
+			options.profile_images = argv[++i];
+		}
+		else if (strcmp(argv[i], "--test-model") == 0 && i + 1 < argc) {
+			test_model = argv[++i];
+		}
+		else if (strcmp(argv[i], "--test-generated") == 0) {
+			test_generated = true;
+		}
+	}
+
+	if (options.best_first && options.level_wise) {
+		std::cout << "Error: --best-first cannot be combined with --level-wise." << std::endl;
+		return 1;
+	}
+
+	// the out-of-bag error needs the training patches in memory
+	if (!options.out_of_core.empty() && (options.benchmark_criteria || options.estimate_oob)) {
+		std::cout << "Error: --out-of-core cannot be combined with --benchmark-criteria or --oob." << std::endl;
+		return 1;
+	}
+
+	if (train || test_generated || !test_model.empty()) {
+		ConsoleProgressMonitor monitor;
+		signal(SIGINT, ConsoleProgressMonitor::onInterrupt);
+
+		bool finished = false;
+		try {
+			if (train) {
+				finished = trainByECP(&monitor, options);
+			}
+			else if (!test_model.empty()) {
+				finished = testModelByECP(test_model, &monitor);
+			}
+			else {
+#ifdef RF_GENERATED_FOREST
+				finished = testGeneratedByECP(&monitor);
+#else
+				std::cout << "Error: this executable was built without RF_GENERATED_FOREST." << std::endl;
+				return 1;
+#endif
+			}
+		}
+		catch (const char* msg) {
+			std::cout << std::endl << "Error: " << msg << std::endl;
+			return 1;
+		}
+		if (!finished) {
+			std::cout << std::endl << "Cancelled." << std::endl;
+			return 1;
+		}
+		return 0;
+	}
+
 	QApplication a(argc, argv);
 	MainWindow w;
 	w.show();